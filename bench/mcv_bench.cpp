@@ -0,0 +1,455 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+/*! mcv_bench: microbenchmarks of the library on synthetic VGA clouds
+ *
+ *  The scene is the default SyntheticScene: a floor, a wall and a sphere
+ *  with depth noise and unmeasured pixels.
+ *
+ *  usage: mcv_bench [options] [output.json]
+ *      --filter <text>   only run the benchmarks whose name contains text
+ *      --min-time <s>    minimum measuring time per benchmark (0.3)
+ *      --threads <n>     worker threads (see mcv::setNumThreads)
+ *      --isa <name>      scalar, sse2 or avx2 (see mcv::setKernelIsa)
+ *      --seed <n>        seed of the synthetic scene (1)
+ *
+ *  Every benchmark runs once untimed, then repeatedly for at least
+ *  --min-time seconds and BENCH_MIN_ITERATIONS iterations. The summary
+ *  goes to stdout; the results, with the configuration they were measured
+ *  with, are written as JSON (default mcv_bench.json) for comparing builds.
+ */
+
+// MCV
+#include "PointCloud.hpp"
+#include "FrameSource.hpp"
+#include "CaptureEngine.hpp"
+#include "GeometryTypes.hpp"
+#include "CameraCalibration.hpp"
+#include "DrawingContext.hpp"
+#include "PointCloudViewer.hpp"
+#include "OffscreenContext.hpp"
+#include "PointKernels.hpp"
+#include "Parallel.hpp"
+#include "Profiler.hpp"
+
+// OpenCV
+#include <opencv2/opencv.hpp>
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum { BENCH_MIN_ITERATIONS = 3,
+       BENCH_MAX_ITERATIONS = 10000 };
+
+static const cv::Size BENCH_SIZE( 640, 480 );
+
+struct BenchResult
+{
+    string name;
+    int    iterations;
+    double items;           // processed per iteration (points, calls, frames)
+    double min, median, mean, p95;  // ms per iteration
+};
+
+struct BenchConfig
+{
+    string filter;
+    double minTime;
+    int    seed;
+};
+
+static vector<BenchResult> results;
+static BenchConfig config;
+
+/*! Times body(); setup() runs before each iteration, outside the timer */
+static void run( const string& name, double items,
+                 const function<void()>& body,
+                 const function<void()>& setup = function<void()>() ){
+    if ( !config.filter.empty() && name.find( config.filter ) == string::npos )
+        return;
+
+    if ( setup ) setup();
+    body();
+
+    vector<double> times;
+    double total = 0;
+    while( ( total < config.minTime*1e3 || (int)times.size() < BENCH_MIN_ITERATIONS ) &&
+           (int)times.size() < BENCH_MAX_ITERATIONS ){
+        if ( setup ) setup();
+        int64_t start = mcv::Profiler::now();
+        body();
+        double ms = ( mcv::Profiler::now() - start )*1e-6;
+        times.push_back( ms );
+        total += ms;
+    }
+
+    sort( times.begin(), times.end() );
+    BenchResult result;
+    result.name       = name;
+    result.iterations = (int)times.size();
+    result.items      = items;
+    result.min        = times.front();
+    result.median     = times[ times.size()/2 ];
+    result.mean       = total/times.size();
+    result.p95        = times[ min( times.size() - 1, size_t( 0.95*times.size() ) ) ];
+    results.push_back( result );
+
+    printf( "%-40s %7d %10.3f %10.3f %10.3f %10.2f\n", name.c_str(), result.iterations,
+            result.min, result.median, result.p95, result.median*1e6/items );
+    fflush( stdout );
+}
+
+/*! Keeps the optimizer from dropping the work of a benchmark */
+static volatile float sink;
+
+static cv::Matx33f rotationX( float angle ){
+    float c = std::cos( angle ), s = std::sin( angle );
+    return cv::Matx33f( 1, 0, 0,
+                        0, c,-s,
+                        0, s, c );
+}
+
+static cv::Matx33f rotationY( float angle ){
+    float c = std::cos( angle ), s = std::sin( angle );
+    return cv::Matx33f( c, 0, s,
+                        0, 1, 0,
+                       -s, 0, c );
+}
+
+static void benchCloud( const mcv::Point3Cloud& scene ){
+    const double points = BENCH_SIZE.area();
+    const cv::Mat& data = scene.getDataView();
+    const cv::Mat& bgr  = scene.getBgrView();
+
+    run( "cloud/construct", points, [&](){
+        mcv::Point3Cloud cloud( data, bgr );
+        sink = cloud.getDataView().at<float>(0);
+    });
+    run( "cloud/copy_shared", 1, [&](){
+        mcv::Point3Cloud cloud( scene );
+        sink = cloud.getDataView().at<float>(0);
+    });
+    run( "cloud/clone", points, [&](){
+        mcv::Point3Cloud cloud = scene.clone();
+        sink = cloud.getDataView().at<float>(0);
+    });
+
+    // The transforms alternate with their inverse so the cloud does not
+    // drift over the iterations; both the grid and the compact view paths
+    for( int compact=0; compact<2; compact++ ){
+        mcv::Point3Cloud cloud = scene.clone();
+        if ( compact )
+            cloud.getCompactData();
+        const string suffix = compact ? "_compact" : "";
+        const cv::Matx33f R = rotationY( 0.1f )*rotationX( 0.05f );
+        const cv::Vec3f t( 0.01f, -0.02f, 0.03f );
+        bool forward = true;
+
+        run( "cloud/applyTransformation" + suffix, points, [&](){
+            if ( forward )
+                cloud.applyTransformation( R, t );
+            else
+                cloud.applyTransformation( R.t(), -( R.t()*t ) );
+            forward = !forward;
+        });
+        run( "cloud/applyRotation" + suffix, points, [&](){
+            cv::Matx33f I = cv::Matx33f::eye();
+            cloud.applyRotation( rotationX( forward ? 0.1f : -0.1f ), I, I );
+            forward = !forward;
+        });
+        run( "cloud/applyTranslation" + suffix, points, [&](){
+            cloud.applyTranslation( forward ? t : -t );
+            forward = !forward;
+        });
+    }
+
+    // setData on a shared header drops the cached bounds without a copy
+    mcv::Point3Cloud cloud( scene );
+    run( "cloud/bounds", points, [&](){
+        sink = cloud.getBBCenter()[2];
+    }, [&](){
+        cloud.setData( cv::Mat( data ) );
+    });
+}
+
+static void benchFrameIO( const mcv::Point3Cloud& scene ){
+    const char* extensions[] = { mcv::FRAME_BINARY_EXTENSION,
+                                 mcv::FRAME_COMPRESSED_EXTENSION, ".yml" };
+    for( int i=0; i<3; i++ ){
+        const string name = string( "mcv_bench_frame" ) + extensions[i];
+        mcv::Point3Cloud cloud( scene );
+        run( string( "io/writeFrame" ) + extensions[i], 1, [&](){
+            cloud.writeFrame( name );
+        });
+        run( string( "io/readFrame" ) + extensions[i], 1, [&](){
+            mcv::Point3Cloud frame;
+            frame.readFrame( name );
+            sink = frame.getDataView().at<float>(0);
+        });
+        remove( name.c_str() );
+    }
+}
+
+static void benchTransformation( const mcv::Point3Cloud& scene,
+                                 const mcv::CameraCalibration& calibration ){
+    const int calls = 100000;
+    mcv::Transformation pose( rotationY( 0.3f )*rotationX( -0.2f ), cv::Vec3f( 0.1f, 0.2f, 0.5f ) );
+
+    run( "transform/getMat44", calls, [&](){
+        float sum = 0;
+        for( int i=0; i<calls; i++ ){
+            pose.t()[0] += 1e-7f;
+            sum += pose.getMat44()(0,3);
+        }
+        sink = sum;
+    });
+    run( "transform/getInverted", calls, [&](){
+        float sum = 0;
+        for( int i=0; i<calls; i++ ){
+            pose.t()[0] += 1e-7f;
+            sum += pose.getInverted().t()[0];
+        }
+        sink = sum;
+    });
+
+    const cv::Mat& points = scene.getDataView();
+    cv::Mat pixels;
+    run( "transform/project", points.total(), [&](){
+        calibration.project( points, pose, pixels );
+        sink = pixels.at<float>(0);
+    });
+}
+
+/*! Frame sources, alone and behind the capture thread of a CaptureEngine */
+static void benchCapture( const mcv::SyntheticScene& scene ){
+    mcv::SyntheticFrameSource source( scene );
+    source.open();
+    mcv::Point3Cloud cloud;
+    run( "capture/synthetic_grab", scene.size.area(), [&](){
+        cloud.grabFrame( source );
+    });
+
+    {
+        mcv::CaptureEngine engine( cv::Ptr<mcv::FrameSource>( new mcv::SyntheticFrameSource( scene ) ) );
+        engine.start();
+        run( "capture/engine_synthetic", 1, [&](){
+            engine.next( cloud );
+        });
+    }
+
+    const string name = string( "mcv_bench_replay" ) + mcv::FRAME_SEQUENCE_EXTENSION;
+    {
+        mcv::FrameSequenceWriter recording( name );
+        for( int i=0; i<8; i++ ){
+            cloud.grabFrame( source );
+            cloud.writeFrame( recording, i/30.0 );
+        }
+        recording.close();
+    }
+    {
+        mcv::ReplayFrameSource replay( name, mcv::REPLAY_FAST, true );
+        mcv::Point3Cloud frame;
+        if ( replay.open() )
+            run( "capture/replay_grab", 1, [&](){
+                frame.grabFrame( replay );
+            });
+    }
+    remove( name.c_str() );
+}
+
+/*! Frame cost of the renderers on a headless context. The pipelined
+ *  variants leave the readback of frame N to overlap with frame N+1, the
+ *  _sync ones wait for each frame. */
+static void benchRenderers( const mcv::Point3Cloud& scene,
+                            const mcv::CameraCalibration& calibration ){
+    if ( !mcv::OffscreenContext::isAvailable() ){
+        cout << "render/*: skipped, built without EGL" << endl;
+        return;
+    }
+
+    try {
+        cv::Mat frame;
+        {
+            mcv::OffscreenContext offscreen( BENCH_SIZE );
+            mcv::DrawingContext drawing( offscreen, calibration );
+            drawing.isPatternPresent = true;
+            drawing.patternPose = mcv::Transformation( rotationX( -1.2f ), cv::Vec3f( 0, 0.1f, 1.2f ) );
+            const cv::Mat& bgr = scene.getBgrView();
+
+            run( "render/ar_frame", 1, [&](){
+                drawing.updateBackground( bgr );
+                drawing.updateWindow();
+                drawing.retrieveFrame( frame );
+            });
+            run( "render/ar_frame_sync", 1, [&](){
+                drawing.updateBackground( bgr );
+                drawing.updateWindow();
+                while( drawing.retrieveFrame( frame, true ) ){
+                }
+            });
+        }
+        {
+            mcv::OffscreenContext offscreen( BENCH_SIZE );
+            mcv::PointCloudViewer viewer( offscreen );
+            viewer.updatePointCloud( scene );
+
+            run( "render/cloud_frame", 1, [&](){
+                viewer.updateWindow();
+                viewer.retrieveFrame( frame );
+            });
+            run( "render/cloud_frame_upload", scene.getValidCount(), [&](){
+                viewer.updatePointCloud( scene );
+                viewer.updateWindow();
+                viewer.retrieveFrame( frame );
+            });
+            run( "render/cloud_frame_sync", 1, [&](){
+                viewer.updateWindow();
+                while( viewer.retrieveFrame( frame, true ) ){
+                }
+            });
+        }
+    }
+    catch( const cv::Exception& e ){
+        cout << "render/*: skipped, " << e.what() << endl;
+    }
+}
+
+static const char* isaName( mcv::KernelIsa isa ){
+    switch( isa ){
+    case mcv::KERNEL_AVX2: return "avx2";
+    case mcv::KERNEL_SSE2: return "sse2";
+    default:               return "scalar";
+    }
+}
+
+static void writeJson( const string& name ){
+    ofstream file( name.c_str() );
+    if ( !file )
+        CV_Error( CV_StsError, "Cannot open " + name );
+
+    file << "{\n\"config\":{\"width\":" << BENCH_SIZE.width << ",\"height\":" << BENCH_SIZE.height
+         << ",\"seed\":" << config.seed << ",\"min_time_s\":" << config.minTime
+         << ",\"threads\":" << mcv::getNumThreads() << ",\"isa\":\"" << isaName( mcv::kernelIsa() )
+         << "\",\"compiler\":\"" << __VERSION__ << "\""
+#ifdef NDEBUG
+         << ",\"debug\":false"
+#else
+         << ",\"debug\":true"
+#endif
+#ifdef MCV_ENABLE_PROFILING
+         << ",\"profiling\":true"
+#else
+         << ",\"profiling\":false"
+#endif
+         << ",\"opencv\":\"" << CV_VERSION << "\"},\n\"results\":[";
+    for( size_t i=0; i<results.size(); i++ ){
+        const BenchResult& r = results[i];
+        file << ( i ? "," : "" ) << "\n{\"name\":\"" << r.name << "\",\"iterations\":" << r.iterations
+             << ",\"items\":" << r.items << ",\"min_ms\":" << r.min << ",\"median_ms\":" << r.median
+             << ",\"mean_ms\":" << r.mean << ",\"p95_ms\":" << r.p95
+             << ",\"ns_per_item\":" << r.median*1e6/r.items << "}";
+    }
+    file << "\n]}\n";
+}
+
+static void usage(){
+    cerr << "usage: mcv_bench [--filter text] [--min-time s] [--threads n]"
+            " [--isa scalar|sse2|avx2] [--seed n] [output.json]" << endl;
+    exit( 1 );
+}
+
+int main( int argc, char * argv[] )
+{
+    string output = "mcv_bench.json";
+    config.minTime = 0.3;
+    config.seed = 1;
+
+    for( int i=1; i<argc; i++ ){
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ( arg == "--filter" && hasValue )
+            config.filter = argv[++i];
+        else if ( arg == "--min-time" && hasValue )
+            config.minTime = atof( argv[++i] );
+        else if ( arg == "--threads" && hasValue )
+            mcv::setNumThreads( atoi( argv[++i] ) );
+        else if ( arg == "--seed" && hasValue )
+            config.seed = atoi( argv[++i] );
+        else if ( arg == "--isa" && hasValue ){
+            string isa = argv[++i];
+            if ( isa == "scalar" )    mcv::setKernelIsa( mcv::KERNEL_SCALAR );
+            else if ( isa == "sse2" ) mcv::setKernelIsa( mcv::KERNEL_SSE2 );
+            else if ( isa == "avx2" ) mcv::setKernelIsa( mcv::KERNEL_AVX2 );
+            else usage();
+        }
+        else if ( arg[0] == '-' )
+            usage();
+        else
+            output = arg;
+    }
+
+    // Frames are produced as fast as they are read
+    mcv::SyntheticScene synthetic;
+    synthetic.size = BENCH_SIZE;
+    synthetic.seed = config.seed;
+    synthetic.frameRate = 0;
+    mcv::SyntheticFrameSource source( synthetic );
+    source.open();
+    mcv::Point3Cloud scene;
+    scene.grabFrame( source );
+    mcv::CameraCalibration calibration( synthetic.fx, synthetic.fy, synthetic.cx, synthetic.cy );
+
+    printf( "%d x %d, %zu valid points, %d threads, %s kernels\n\n", BENCH_SIZE.width,
+            BENCH_SIZE.height, scene.getValidCount(), mcv::getNumThreads(),
+            isaName( mcv::kernelIsa() ) );
+    printf( "%-40s %7s %10s %10s %10s %10s\n", "benchmark", "iters", "min ms",
+            "median ms", "p95 ms", "ns/item" );
+
+    benchCloud( scene );
+    benchFrameIO( scene );
+    benchCapture( synthetic );
+    benchTransformation( scene, calibration );
+    benchRenderers( scene, calibration );
+
+    writeJson( output );
+    cout << "\nresults written to " << output << endl;
+    return 0;
+}
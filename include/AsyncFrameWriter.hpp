@@ -0,0 +1,144 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __ASYNCFRAMEWRITER_HPP__
+#define __ASYNCFRAMEWRITER_HPP__
+
+#include "PointCloud.hpp"
+#include "FrameSequence.hpp"
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*! Background persistence of Point3Cloud frames
+ *
+ *  write() takes the buffers of the caller's cloud by swapping them with a
+ *  recycled cloud (a frame that has already been written), so submitting a
+ *  frame copies no pixels and, once warmed up, allocates nothing. The
+ *  cloud handed back holds stale data of the same size and is meant to be
+ *  refilled, e.g. by CaptureEngine::next() or Point3Cloud::grabFrame().
+ *
+ *  Encoding and disk writes run on worker threads. At most queueSize
+ *  frames are in flight: write() blocks and tryWrite() refuses once the
+ *  disk falls behind that far.
+ *
+ *  In snapshot mode each frame goes to its own file, the format following
+ *  the extension as in Point3Cloud::writeFrame. In recording mode frames
+ *  are encoded in parallel and appended to the sequence in submission
+ *  order.
+ */
+namespace mcv {
+
+struct AsyncWriterStats
+{
+    uint64_t submitted;
+    uint64_t written;
+    uint64_t rejected;          // tryWrite() calls refused by a full queue
+    uint64_t failed;            // frames lost to an I/O or encoding error
+    double   blockedMs;         // total time write() waited for room
+};
+
+class AsyncFrameWriter
+{
+public:
+    /*! Snapshot mode */
+    explicit AsyncFrameWriter( size_t workers = 2, size_t queueSize = 8 );
+    /*! Recording mode, the sequence must outlive the writer */
+    AsyncFrameWriter( mcv::FrameSequenceWriter& sequence,
+                      mcv::FrameEncoding encoding = mcv::FRAME_ENCODING_RAW,
+                      size_t workers = 2, size_t queueSize = 8 );
+    /*! Drains the queue */
+    ~AsyncFrameWriter();
+
+    /*! Snapshot mode: queues the cloud for writing to a file */
+    void write( mcv::Point3Cloud& cloud, const std::string& name );
+    bool tryWrite( mcv::Point3Cloud& cloud, const std::string& name );
+
+    /*! Recording mode: queues the cloud for appending to the sequence */
+    void write( mcv::Point3Cloud& cloud, double timestamp );
+    bool tryWrite( mcv::Point3Cloud& cloud, double timestamp );
+
+    /*! Waits until every queued frame has been written */
+    void flush();
+
+    size_t pending() const;
+    AsyncWriterStats stats() const;
+    /*! Message of the last failure, empty if none */
+    std::string lastError() const;
+
+private:
+    AsyncFrameWriter( const AsyncFrameWriter& );
+    AsyncFrameWriter& operator=( const AsyncFrameWriter& );
+
+    struct Job
+    {
+        mcv::Point3Cloud cloud;
+        std::string      name;
+        double           timestamp;
+        uint64_t         order;
+    };
+
+    void startWorkers( size_t workers );
+    bool submit( mcv::Point3Cloud& cloud, const std::string& name,
+                 double timestamp, bool wait );
+    void run();
+    void process( Job& job, std::vector<uchar>& blob );
+
+    mcv::FrameSequenceWriter*     m_sequence;
+    mcv::FrameEncoding            m_encoding;
+    size_t                        m_capacity;
+
+    mutable std::mutex            m_mutex;
+    std::condition_variable       m_work;       // jobs queued or stopping
+    std::condition_variable       m_room;       // a frame left the pipeline
+    std::deque<Job>               m_queue;
+    std::deque<mcv::Point3Cloud>  m_free;       // written frames to recycle
+    size_t                        m_inFlight;   // queued + being written
+    uint64_t                      m_nextOrder;
+    bool                          m_stopping;
+
+    // Appends to the sequence happen in submission order, outside m_mutex
+    std::mutex                    m_commitMutex;
+    std::condition_variable       m_turn;
+    uint64_t                      m_nextCommit;
+
+    AsyncWriterStats              m_stats;
+    std::string                   m_lastError;
+    std::vector<std::thread>      m_workers;
+};
+
+} // mcv
+
+#endif
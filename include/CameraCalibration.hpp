@@ -7,6 +7,8 @@
 #ifndef CameraCalibration_hpp
 #define CameraCalibration_hpp
 
+#include "GeometryTypes.hpp"
+
 #include <opencv2/opencv.hpp>
 
 /**
@@ -20,6 +22,7 @@ public:
     CameraCalibration(float fx, float fy, float cx, float cy);
     CameraCalibration(float fx, float fy, float cx, float cy, float distorsionCoeff[5]);
 
+    /*! Projection matrix K*[I|0] */
     void getMatrix34(float cparam[3][4]) const;
 
     const cv::Matx33f& getIntrinsic() const;
@@ -36,9 +39,72 @@ public:
 
     float cx() const;
     float cy() const;
+
+    /*! Direction (x, y, 1) of the ray through every pixel of an image of
+     *  the given size, distortion removed (CV_32FC3). Built on first use and
+     *  kept until the size, an intrinsic or a distortion coefficient
+     *  changes. Rebuilding is not thread-safe. */
+    const cv::Mat& getRays(const cv::Size& size) const;
+
+    /*! Removes the lens distortion from an image with fixed-point remap
+     *  tables (CV_16SC2 + CV_16UC1) built for its size on first use and
+     *  kept until the size or a parameter changes, so a frame only costs
+     *  the remap. Without distortion the frame is copied. Rebuilding is not
+     *  thread-safe. */
+    void undistortFrame(const cv::Mat& frame, cv::Mat& undistorted) const;
+    /*! True when a distortion coefficient is not zero */
+    bool hasDistortion() const;
+
+    /*! Pixels of points given in the pose frame, i.e. the projection of
+     *  pose.r()*p + pose.t() with the distortion model of cv::projectPoints,
+     *  in float precision with the vectorized kernels of PointKernels.hpp.
+     *  points is CV_32FC3 of any shape, pixels gets CV_32FC2 of the same
+     *  shape; large batches are spread over the thread pool. */
+    void project(const cv::Mat& points, const Transformation& pose, cv::Mat& pixels) const;
+    void project(const cv::Vec3f* points, cv::Vec2f* pixels, size_t count,
+                 const Transformation& pose) const;
+    /*! Small fixed-size point sets, without allocation */
+    template<size_t N>
+    void project(const cv::Vec3f (&points)[N], const Transformation& pose,
+                 cv::Vec2f (&pixels)[N]) const
+    {
+        project(points, pixels, N, pose);
+    }
 private:
+    /*! fx, fy, cx, cy and the five distortion coefficients, keying the
+     *  cached tables */
+    void snapshot(float params[9]) const;
+
     cv::Matx33f     m_intrinsic;
     cv::Mat_<float> m_distortion;
+
+    struct RayCache
+    {
+        float    params[9];
+        cv::Size size;
+        cv::Mat  rays;
+    };
+    mutable RayCache m_rays;
+
+    struct UndistortCache
+    {
+        float    params[9];
+        cv::Size size;
+        cv::Mat  map1, map2;
+    };
+    mutable UndistortCache m_undistort;
 };
+
+/*! Fits the pinhole intrinsics of an organized CV_32FC3 point cloud map
+ *  (such as CV_CAP_OPENNI_POINT_CLOUD_MAP) by least squares on x/z and
+ *  y/z against the pixel coordinates. The signs of fx/fy follow the axes
+ *  of the map. Returns false when there are too few valid points. */
+bool estimateCalibration( const cv::Mat& pointCloudMap, CameraCalibration& calibration );
+
+/*! Back-projects a depth image (CV_16UC1 or CV_32FC1, depthScale units
+ *  per meter) along the rays of the calibration into a CV_32FC3 map. Zero
+ *  depths give points at the origin, NaN depths NaN points. */
+void backprojectDepth( const cv::Mat& depth, const CameraCalibration& calibration,
+                       cv::Mat& xyz, float depthScale );
 } //mcv
 #endif
@@ -0,0 +1,127 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __CAPTUREENGINE_HPP__
+#define __CAPTUREENGINE_HPP__
+
+#include "PointCloud.hpp"
+#include "FrameSource.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! Asynchronous capture
+ *
+ *  The engine owns a frame source (the OpenNI device by default, see
+ *  FrameSource.hpp for the synthetic and replay ones) and grabs on a
+ *  dedicated thread into
+ *  a fixed ring of preallocated Point3Cloud slots. When consumers fall
+ *  behind, the oldest unread frame is overwritten (drop-oldest). Frames are
+ *  handed over by swapping buffers with the caller's cloud, so delivering a
+ *  frame never copies pixels and the ring never reallocates once the
+ *  caller's cloud has the sensor resolution.
+ */
+namespace mcv {
+
+struct CaptureStats
+{
+    uint64_t captured;          // frames grabbed from the source
+    uint64_t delivered;         // frames handed to consumers
+    uint64_t dropped;           // frames overwritten or skipped unread
+    double   meanLatencyMs;     // capture to consume
+    double   maxLatencyMs;
+};
+
+class CaptureEngine
+{
+public:
+    /*! Captures from an OpenNIFrameSource on the given device */
+    CaptureEngine( int device = CV_CAP_OPENNI, size_t ringSize = 4,
+                   bool grabColor = true );
+    CaptureEngine( const cv::Ptr<mcv::FrameSource>& source, size_t ringSize = 4,
+                   bool grabColor = true );
+    ~CaptureEngine();
+
+    /*! Opens the source and starts the capture thread */
+    bool start();
+    /*! Stops the capture thread and closes the source */
+    void stop();
+    bool isRunning() const;
+
+    /*! Newest captured frame, discarding the older unread ones. Never
+     *  blocks; returns false when no new frame is available. */
+    bool latest( mcv::Point3Cloud& cloud, double* timestamp = 0 );
+    /*! Oldest unread frame, waiting up to timeoutMs (forever if negative).
+     *  Returns false on timeout or once the engine stopped and drained. */
+    bool next( mcv::Point3Cloud& cloud, int timeoutMs = -1, double* timestamp = 0 );
+
+    CaptureStats stats() const;
+
+    /*! Direct access to the source, only valid before start() */
+    mcv::FrameSource& source();
+
+private:
+    CaptureEngine( const CaptureEngine& );
+    CaptureEngine& operator=( const CaptureEngine& );
+
+    struct Slot
+    {
+        mcv::Point3Cloud cloud;
+        double           timestamp;  // seconds, see frameClock()
+    };
+
+    void run();
+    void deliver( size_t index, mcv::Point3Cloud& cloud, double* timestamp );
+
+    cv::Ptr<FrameSource>    m_source;
+    bool                    m_grabColor;
+
+    std::vector<Slot>       m_ring;
+    size_t                  m_head;      // oldest unread slot
+    size_t                  m_count;     // unread slots
+
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_ready;
+    std::thread             m_thread;
+    std::atomic<bool>       m_running;
+
+    CaptureStats            m_stats;
+    double                  m_latencySum;
+};
+
+} // mcv
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "GeometryTypes.hpp"
 #include "CameraCalibration.hpp"
+#include "OffscreenContext.hpp"
 
 #include <opencv2/opencv.hpp>
 
@@ -19,29 +20,51 @@ class DrawingContext
 {
 public:
     DrawingContext(std::string windowName, cv::Size frameSize, const CameraCalibration& c);
+    //! Headless: renders into the framebuffer of offscreen, which must
+    //! outlive the context
+    DrawingContext(OffscreenContext& offscreen, const CameraCalibration& c);
     ~DrawingContext();
   
     bool isPatternPresent;
     Transformation patternPose;
 
-    //! Set the new frame for the background
+    //! Set the new frame for the background, undistorted with the calibration.
+    //! Without distortion the frame is not copied, only referenced until it
+    //! is uploaded by the next redraw, so it must not be written meanwhile
     void updateBackground(const cv::Mat& frame);
+    //! Redraws the window, or renders a frame offscreen and queues its readback
     void updateWindow();
+    //! Headless only: the oldest rendered frame, see OffscreenContext::retrieveFrame
+    bool retrieveFrame(cv::Mat& image, bool wait = false);
 
 private:
+    DrawingContext(const CameraCalibration& c, OffscreenContext* offscreen, const std::string& windowName);
+
     friend void DrawingContextDrawCallback(void* param);
+    //! Makes the window or offscreen context current
+    void makeCurrent();
     //! Render entire scene in the OpenGl window
     void draw();
 
     //! Draws the background with video
     void drawCameraFrame();
 
+    //! Streams a new background into the texture through the pixel buffer
+    void uploadBackground();
+
     //! Draws the AR
     void drawAugmentedScene();
 
     //! Builds the right projection matrix from the camera calibration for AR
     void buildProjectionMatrix(const CameraCalibration& calibration, int w, int h, Matx44f& result);
 
+    //! Rebuilds the cached AR and colour bar projections when the
+    //! calibration, the frame size or the viewport changed
+    void updateProjections();
+
+    //! Bakes the cube and the axes into vertex buffers
+    void initOverlayBuffers();
+
     //! Draws the coordinate axis
     void drawCoordinateAxis();
 
@@ -54,9 +77,25 @@ private:
 private:
     bool m_isTextureInitialized;
     unsigned int m_backgroundTextureId;
+    cv::Size m_textureSize;
+    int m_textureChannels;
+    unsigned int m_pixelBufferId;
+    bool m_isBackgroundUploaded;
+    bool m_areOverlayBuffersInitialized;
+    unsigned int m_cubeBufferId;
+    unsigned int m_axisBufferId;
+    unsigned int m_colorBarBufferId;
+    int m_colorBarVertexCount;
+    cv::Vec4i m_colorBarLayout;          // size_x, size_y, x_init, y_init of the colour bar buffer
+    Matx44f m_projectionMatrix;          // column-major, ready for glLoadMatrixf
+    Matx44f m_colorBarProjection;        // pixel coordinates over the viewport
+    cv::Vec4f m_projectionIntrinsics;    // fx, fy, cx, cy of m_projectionMatrix
+    cv::Size m_projectionSize;
+    cv::Vec4i m_projectionViewport;
     CameraCalibration m_calibration;
     cv::Mat m_backgroundImage;
     std::string m_windowName;
+    OffscreenContext* m_offscreen;
 };
 }// mcv
 #endif
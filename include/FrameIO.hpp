@@ -0,0 +1,149 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __FRAMEIO_HPP__
+#define __FRAMEIO_HPP__
+
+#include "CameraCalibration.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*! Binary frame container ("MCVF")
+ *
+ *  A frame is stored as a fixed 128 byte header followed by the XYZ plane
+ *  and the BGR plane, each starting on a 64 byte boundary. The planes are
+ *  stored exactly as they are laid out in memory, so a mapped file can be
+ *  wrapped by cv::Mat headers without any parse step. A Fletcher-64
+ *  checksum over the whole frame, header included with the checksum field
+ *  zeroed, guards against corrupted files when the reader asks for it.
+ *  Version 1 frames only checksum the planes and are still readable.
+ *
+ *  FRAME_ENCODING_DEPTH16 trades the zero-copy mapping for size: the XYZ
+ *  plane is replaced by a 16 bit depth image (FRAME_DEPTH_SCALE units per
+ *  meter) plus the pinhole intrinsics needed to rebuild X and Y, and both
+ *  planes are stored as PNG (prediction filters + deflate). The encoding
+ *  is lossy: every rebuilt coordinate is within one depth quantum
+ *  (1/FRAME_DEPTH_SCALE, 1 mm) of the original. Only the PNG stage itself
+ *  is lossless, for the quantized depth and the colours.
+ */
+namespace mcv {
+
+/*! File extensions selecting the binary container in readFrame/writeFrame */
+extern const char* const FRAME_BINARY_EXTENSION;        // FRAME_ENCODING_RAW
+extern const char* const FRAME_COMPRESSED_EXTENSION;    // FRAME_ENCODING_DEPTH16
+
+/*! Depth quantum of FRAME_ENCODING_DEPTH16, in units per meter (1 mm) */
+const float FRAME_DEPTH_SCALE = 1000.f;
+
+enum { FRAME_FORMAT_VERSION = 2,
+       FRAME_HEADER_SIZE    = 128,
+       FRAME_PLANE_ALIGN    = 64 };
+
+enum FrameEncoding { FRAME_ENCODING_RAW     = 0,
+                     FRAME_ENCODING_DEPTH16 = 1 };
+
+struct FrameHeader
+{
+    char     magic[4];      // "MCVF"
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t encoding;      // FrameEncoding
+    int32_t  rows;
+    int32_t  cols;
+    int32_t  dataType;      // cv::Mat type of the XYZ plane, CV_32FC3
+    int32_t  bgrType;       // cv::Mat type of the BGR plane, -1 if absent
+    uint64_t dataOffset;    // from the start of the frame
+    uint64_t dataBytes;
+    uint64_t bgrOffset;
+    uint64_t bgrBytes;
+    uint64_t checksum;      // over the frame with this field zeroed (v1: planes only)
+    float    intrinsics[4]; // fx, fy, cx, cy (FRAME_ENCODING_DEPTH16)
+    float    depthScale;    // depth units per meter (FRAME_ENCODING_DEPTH16)
+    uint8_t  reserved[FRAME_HEADER_SIZE - 92];
+};
+
+/*! Read-only view of a whole file, mapped in memory when the platform
+ *  allows it. Pages are mapped copy-on-write, so matrices wrapping the
+ *  mapping may be modified in place without touching the file. */
+class MappedFile
+{
+public:
+    explicit MappedFile( const std::string& name );
+    ~MappedFile();
+
+    uchar* data() const;
+    size_t size() const;
+
+private:
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+
+    uchar* m_data;
+    size_t m_size;
+    bool   m_mapped;
+};
+
+/*! Lower-case extension of a file name, including the dot ("" if none) */
+std::string fileExtension( const std::string& name );
+
+/*! Fletcher-64 checksum of a buffer */
+uint64_t frameChecksum( const uchar* buffer, size_t size );
+
+/*! Serialize the planes of a frame into a self-contained blob.
+ *  FRAME_ENCODING_DEPTH16 keeps every coordinate within one depth quantum
+ *  (1 mm); a frame it cannot store that closely (not a projective
+ *  CV_32FC3 map, depth out of range, NaN points) falls back to
+ *  FRAME_ENCODING_RAW, which is exact. Only the invalid points at the
+ *  origin have a depth code (0). Returns the encoding actually used. */
+FrameEncoding encodeFrame( const cv::Mat& data, const cv::Mat& bgr,
+                           std::vector<uchar>& blob,
+                           FrameEncoding encoding = FRAME_ENCODING_RAW );
+
+/*! Restore the planes stored in a blob. Raw planes reference the blob
+ *  memory (no copy), which must outlive them; compressed planes are
+ *  decoded into newly allocated matrices. Throws cv::Exception on a bad
+ *  header (offsets, sizes and types are checked against the geometry and
+ *  the blob size), truncation or, with verify, checksum failure. The
+ *  header is always validated; the checksum is opt-in because it reads
+ *  every byte of the frame, which faults in the whole mapping and costs
+ *  more than the zero-copy wrap it guards. Returns the frame size. */
+size_t decodeFrame( uchar* blob, size_t size,
+                    cv::Mat& data, cv::Mat& bgr, bool verify = false );
+
+/*! Write a blob to disk in one go */
+void writeBlob( const std::string& name, const std::vector<uchar>& blob );
+
+} // mcv
+
+#endif
@@ -0,0 +1,142 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __FRAMESEQUENCE_HPP__
+#define __FRAMESEQUENCE_HPP__
+
+#include "FrameIO.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*! Multi-frame recording container ("MCVS")
+ *
+ *  file    := FileHeader chunk* index footer
+ *  chunk   := ChunkHeader record*
+ *  record  := RecordHeader frame      (frame is an MCVF blob, see FrameIO)
+ *  index   := IndexEntry*             (one per frame, in recording order)
+ *
+ *  Every structure is 64 bytes aligned, so the frames of a mapped sequence
+ *  can be wrapped in place exactly like a single .mcvf file. The writer only
+ *  ever appends; frames are buffered and written one chunk at a time. When
+ *  a recording was interrupted before the index was written, the reader
+ *  rebuilds it by walking the chunk headers.
+ */
+namespace mcv {
+
+/*! File extension used by recordings */
+extern const char* const FRAME_SEQUENCE_EXTENSION;
+
+struct SequenceIndexEntry
+{
+    uint64_t offset;        // of the frame blob, from the start of the file
+    uint64_t bytes;
+    double   timestamp;     // seconds
+};
+
+class FrameSequenceWriter
+{
+public:
+    /*! Creates (or truncates) a recording. Frames are stored with the given
+     *  encoding and chunks are flushed to disk once they hold chunkBytes of
+     *  encoded frames. */
+    explicit FrameSequenceWriter( const std::string& name,
+                                  FrameEncoding encoding = FRAME_ENCODING_RAW,
+                                  size_t chunkBytes = 32u<<20 );
+    ~FrameSequenceWriter();
+
+    /*! Appends one frame */
+    void write( const cv::Mat& data, const cv::Mat& bgr, double timestamp );
+    /*! Appends a frame already encoded with encodeFrame() */
+    void writeEncoded( const std::vector<uchar>& blob, double timestamp );
+
+    /*! Writes the pending chunk */
+    void flush();
+    /*! Flushes, then writes the index and the footer */
+    void close();
+
+    bool isOpened() const;
+    size_t frameCount() const;
+
+private:
+    FrameSequenceWriter( const FrameSequenceWriter& );
+    FrameSequenceWriter& operator=( const FrameSequenceWriter& );
+
+    void writeBytes( const void* buffer, size_t size );
+
+    FILE*                           m_file;
+    FrameEncoding                   m_encoding;
+    uint64_t                        m_offset;     // bytes already on disk
+    size_t                          m_chunkBytes;
+    std::vector<uchar>              m_chunk;
+    size_t                          m_chunkFrames;
+    std::vector<SequenceIndexEntry> m_index;
+    std::vector<uchar>              m_scratch;
+};
+
+class FrameSequenceReader
+{
+public:
+    /*! verifyFrames checks the checksum of every frame read, see
+     *  mcv::decodeFrame. The index is always verified. */
+    explicit FrameSequenceReader( const std::string& name, bool verifyFrames = false );
+
+    size_t size() const;
+    double timestamp( size_t i ) const;
+
+    /*! Position of the next frame returned by read() */
+    size_t tell() const;
+    /*! O(1) random access through the index */
+    void seek( size_t i );
+
+    /*! Wraps the next frame in place (no copy) and advances. The
+     *  matrices stay valid as long as mapping() is referenced. Returns
+     *  false at the end of the recording. */
+    bool read( cv::Mat& data, cv::Mat& bgr, double* timestamp = 0 );
+
+    const cv::Ptr<MappedFile>& mapping() const;
+
+private:
+    bool loadIndex();
+    void rebuildIndex();
+
+    cv::Ptr<MappedFile>             m_file;
+    std::vector<SequenceIndexEntry> m_index;
+    size_t                          m_position;
+    bool                            m_verify;
+};
+
+} // mcv
+
+#endif
@@ -0,0 +1,215 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __FRAMESOURCE_HPP__
+#define __FRAMESOURCE_HPP__
+
+#include "FrameIO.hpp"
+#include "FrameSequence.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*! Frame sources
+ *
+ *  Anything that produces XYZ + BGR frames the way the OpenNI capture does:
+ *  the live device, a procedural scene, or a recording played back. A
+ *  source is read one frame at a time by Point3Cloud::grabFrame or driven
+ *  by a CaptureEngine, so the whole pipeline can run, and be measured,
+ *  without a sensor attached.
+ *
+ *  Timestamps are in seconds on the frameClock() time base, taken when the
+ *  frame becomes available to the reader.
+ */
+namespace mcv {
+
+/*! Seconds on the cv::getTickCount clock */
+double frameClock();
+
+/*! Retrieves the frame last grabbed by an OpenNI capture: the point cloud
+ *  map into data and, if grabColor, the BGR image into bgr. Both are only
+ *  assigned once every plane was retrieved, false leaves them untouched. */
+bool retrieveOpenNIFrame( cv::VideoCapture& capture, cv::Mat& data, cv::Mat& bgr,
+                          bool grabColor );
+
+class FrameSource
+{
+public:
+    virtual ~FrameSource();
+
+    /*! Opens the source, false if it is not available */
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    virtual bool isOpened() const = 0;
+
+    /*! Waits until the next frame is due and stores it: data gets the
+     *  points (CV_32FC3, meters, invalid ones at the origin) and, if
+     *  grabColor, bgr the image (CV_8UC3); bgr is left alone otherwise.
+     *  Buffers of the right size and type are written in place. Returns
+     *  false, before touching the matrices, when the source is closed,
+     *  exhausted or failed. */
+    virtual bool read( cv::Mat& data, cv::Mat& bgr, bool grabColor,
+                       double* timestamp = 0 ) = 0;
+
+    /*! File the matrices of the last read() point into, which must be kept
+     *  alive with them; empty when they own their memory */
+    virtual cv::Ptr<mcv::MappedFile> mapping() const;
+};
+
+/*! Live capture through cv::VideoCapture, OpenNI retrieve flags */
+class OpenNIFrameSource : public FrameSource
+{
+public:
+    explicit OpenNIFrameSource( int device = CV_CAP_OPENNI );
+
+    bool open();
+    void close();
+    bool isOpened() const;
+    bool read( cv::Mat& data, cv::Mat& bgr, bool grabColor, double* timestamp = 0 );
+
+    /*! The underlying capture, e.g. to change the sensor settings */
+    cv::VideoCapture& device();
+
+private:
+    int              m_deviceId;
+    cv::VideoCapture m_device;
+};
+
+/*! Plane of the points p with normal.dot(p) == distance. A non-zero
+ *  checker size (meters) alternates color with a darker shade. */
+struct SyntheticPlane
+{
+    SyntheticPlane( const cv::Vec3f& normal, float distance,
+                    const cv::Vec3b& color, float checker = 0.f );
+
+    cv::Vec3f normal;
+    float     distance;
+    cv::Vec3b color;
+    float     checker;
+};
+
+struct SyntheticSphere
+{
+    SyntheticSphere( const cv::Vec3f& center, float radius, const cv::Vec3b& color );
+
+    cv::Vec3f center;
+    float     radius;
+    cv::Vec3b color;
+};
+
+/*! Scene seen by a pinhole camera at the origin looking down +Z, with X
+ *  to the right and Y up (the OpenNI point cloud map). The default one is
+ *  a Kinect-like VGA camera facing a checkered floor, a back wall and a
+ *  sphere. */
+struct SyntheticScene
+{
+    SyntheticScene();
+
+    cv::Size                     size;
+    float                        fx, fy, cx, cy;
+    std::vector<SyntheticPlane>  planes;
+    std::vector<SyntheticSphere> spheres;
+    /*! Depth noise standard deviation at 1 m, growing with the square of
+     *  the depth like a structured light sensor (meters) */
+    float                        noise;
+    /*! Fraction of the pixels reported as not measured */
+    float                        invalidRatio;
+    /*! Frame i of a scene only depends on the seed and i */
+    uint64_t                     seed;
+    /*! Pacing of read(), 0 for as fast as possible */
+    double                       frameRate;
+};
+
+/*! Procedural frames, deterministic for a given seed */
+class SyntheticFrameSource : public FrameSource
+{
+public:
+    explicit SyntheticFrameSource( const SyntheticScene& scene = SyntheticScene() );
+
+    bool open();
+    void close();
+    bool isOpened() const;
+    bool read( cv::Mat& data, cv::Mat& bgr, bool grabColor, double* timestamp = 0 );
+
+    const SyntheticScene& scene() const;
+    /*! Index of the frame returned by the next read(), reset by open() */
+    uint64_t frameIndex() const;
+
+    /*! Renders frame i of the scene, without pacing, parallel over rows */
+    void render( uint64_t frame, cv::Mat& data, cv::Mat& bgr, bool grabColor = true ) const;
+
+private:
+    SyntheticScene m_scene;
+    bool           m_isOpened;
+    uint64_t       m_frame;
+    double         m_nextDue;   // frameClock() time of the next frame
+};
+
+enum ReplayPacing { REPLAY_REALTIME = 0,    // frames spaced as they were recorded
+                    REPLAY_FAST     = 1 };  // as fast as they can be read
+
+/*! Playback of a FrameSequenceWriter recording (.mcvs). Frames are wrapped
+ *  in the mapped file, no copy. */
+class ReplayFrameSource : public FrameSource
+{
+public:
+    explicit ReplayFrameSource( const std::string& name,
+                                ReplayPacing pacing = REPLAY_REALTIME,
+                                bool loop = false );
+
+    /*! False if the file cannot be read as a recording */
+    bool open();
+    void close();
+    bool isOpened() const;
+    /*! With loop, starts over after the last frame */
+    bool read( cv::Mat& data, cv::Mat& bgr, bool grabColor, double* timestamp = 0 );
+    cv::Ptr<mcv::MappedFile> mapping() const;
+
+    /*! Recorded timestamp of the last frame read */
+    double recordedTimestamp() const;
+
+private:
+    std::string                       m_name;
+    ReplayPacing                      m_pacing;
+    bool                              m_loop;
+    cv::Ptr<mcv::FrameSequenceReader> m_reader;
+    cv::Mat                           m_scratch;    // bgr plane when not wanted
+    bool                              m_isStarted;  // pacing origin set
+    double                            m_clockStart;
+    double                            m_recordStart;
+    double                            m_recorded;
+};
+
+} // mcv
+
+#endif
@@ -0,0 +1,81 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __NORMALS_HPP__
+#define __NORMALS_HPP__
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+/*! Surface normals of organized clouds
+ *
+ *  The normal of a pixel is the direction of least variance of the valid
+ *  points in the square window around it, i.e. the eigenvector of the
+ *  smallest eigenvalue of their covariance. The covariance comes from
+ *  integral images of the point count, the coordinates and their pairwise
+ *  products, so each pixel costs four lookups whatever the window size.
+ *  Both the integral images and the per-pixel solve run in parallel.
+ *  Normals face the camera (origin); pixels without a point, or with too
+ *  few valid neighbours, get (0,0,0).
+ */
+namespace mcv {
+
+class NormalEstimator
+{
+public:
+    /*! Window of (2*radius + 1)^2 pixels; minValidRatio of them must hold
+     *  a point for the normal to be computed */
+    explicit NormalEstimator( int radius = 4, float minValidRatio = 0.25f );
+
+    void setRadius( int radius );
+    int getRadius() const;
+    void setMinValidRatio( float minValidRatio );
+    float getMinValidRatio() const;
+
+    /*! Normals of an organized CV_32FC3 grid, into a CV_32FC3 grid of the
+     *  same size. The integral images are kept for the next call. */
+    void compute( const cv::Mat& points, cv::Mat& normals );
+
+private:
+    /*! Sums over a rectangle: count, x, y, z, xx, xy, xz, yy, yz, zz */
+    struct Moments
+    {
+        double m[10];
+    };
+
+    int                  m_radius;
+    float                m_minValidRatio;
+    std::vector<Moments> m_integral;   // (rows+1) x (cols+1)
+};
+
+} // mcv
+
+#endif
@@ -0,0 +1,143 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __OCTREE_HPP__
+#define __OCTREE_HPP__
+
+#include "PointCloud.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <utility>
+#include <vector>
+
+/*! Octree spatial index
+ *
+ *  Indexes the valid points of a cloud (its compact view). The points are
+ *  reordered so that every node covers a contiguous range of them, and
+ *  every node keeps the tight bounding box of its points for pruning.
+ *  Nodes live in a single pool (the non-empty children of a node are
+ *  stored next to each other) that keeps its capacity across rebuilds, so
+ *  rebuilding every frame does not allocate once the pool has grown. The
+ *  subtrees below the root are built in parallel.
+ *
+ *  Query results are indices into getPoints(), i.e. rows of the compact
+ *  view of the indexed cloud; getCompactIndex() of that cloud maps them
+ *  back to the organized grid. The batched queries run in parallel over
+ *  bands of query points; consecutive queries of a band seed their search
+ *  radius with the previous result, which pays off for spatially coherent
+ *  queries such as the pixels of another frame.
+ */
+namespace mcv {
+
+class Octree
+{
+public:
+    explicit Octree( int leafCapacity = 32, int maxDepth = 20 );
+
+    /*! Points per leaf before it is split, and depth at which splitting
+     *  stops regardless (duplicated points) */
+    void setLeafCapacity( int leafCapacity );
+    int getLeafCapacity() const;
+    void setMaxDepth( int maxDepth );
+    int getMaxDepth() const;
+
+    /*! Indexes the valid points of a cloud, replacing the previous ones */
+    void build( const mcv::Point3Cloud& cloud );
+    void clear();
+
+    bool empty() const;
+    size_t size() const;
+    size_t nodeCount() const;
+    /*! Indexed points, N x 1 CV_32FC3 (shared with the cloud's compact view) */
+    const cv::Mat& getPoints() const;
+
+    /*! The k nearest points, closest first. Returns the number found
+     *  (less than k only if the tree holds less than k points). */
+    int nearestKSearch( const cv::Vec3f& query, int k, std::vector<int>& indices,
+                        std::vector<float>& sqrDistances ) const;
+    /*! Every point within radius of query, in no particular order */
+    int radiusSearch( const cv::Vec3f& query, float radius, std::vector<int>& indices,
+                      std::vector<float>& sqrDistances ) const;
+    /*! Every point inside the axis-aligned box [pmin, pmax] */
+    int boxSearch( const cv::Vec3f& pmin, const cv::Vec3f& pmax,
+                   std::vector<int>& indices ) const;
+
+    /*! Batched queries over a continuous CV_32FC3 matrix of points, one
+     *  result row per query point in element order. nearestKSearch fills
+     *  count x k matrices (CV_32SC1 indices, CV_32FC1 squared distances),
+     *  padded with -1 / FLT_MAX when the tree holds less than k points. */
+    void nearestKSearch( const cv::Mat& queries, int k, cv::Mat& indices,
+                         cv::Mat& sqrDistances ) const;
+    void radiusSearch( const cv::Mat& queries, float radius,
+                       std::vector< std::vector<int> >& indices ) const;
+
+private:
+    struct Node
+    {
+        cv::Vec3f pmin, pmax;   // tight bounds of the points below
+        int       begin, end;   // range in m_points
+        int       firstChild;   // first non-empty child, -1 for a leaf
+        int       childCount;
+    };
+
+    typedef std::pair<float,int> Candidate;   // squared distance, point
+
+    void buildSubtree( std::vector<Node>& nodes, int slot, int begin, int end,
+                       const cv::Vec3f& center, float half, int depth,
+                       std::vector<cv::Vec3f>& pointScratch,
+                       std::vector<int>& indexScratch );
+    void splitRange( int begin, int end, const cv::Vec3f& center, int first[9],
+                     std::vector<cv::Vec3f>& pointScratch,
+                     std::vector<int>& indexScratch );
+
+    /*! k-NN among the points within sqrt(radius2), heap sorted on return */
+    void searchNearestK( const cv::Vec3f& query, int k, float radius2,
+                         std::vector<Candidate>& heap ) const;
+    void searchNearestK( int node, const cv::Vec3f& query, int k,
+                         std::vector<Candidate>& heap, float& radius2 ) const;
+    void searchRadius( int node, const cv::Vec3f& query, float radius2,
+                       std::vector<int>& indices, std::vector<float>* sqrDistances ) const;
+    void searchBox( int node, const cv::Vec3f& pmin, const cv::Vec3f& pmax,
+                    std::vector<int>& indices ) const;
+
+    int m_leafCapacity;
+    int m_maxDepth;
+
+    cv::Mat                          m_source;    // compact view of the cloud
+    std::vector<cv::Vec3f>           m_points;    // reordered by node
+    std::vector<int>                 m_indices;   // row in m_source of m_points[i]
+    std::vector<Node>                m_nodes;     // pool, root first
+    std::vector< std::vector<Node> > m_subtrees;  // per root child, reused
+};
+
+} // mcv
+
+#endif
@@ -0,0 +1,96 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __OFFSCREENCONTEXT_HPP__
+#define __OFFSCREENCONTEXT_HPP__
+
+#include <opencv2/opencv.hpp>
+
+/*! Headless OpenGL rendering
+ *
+ *  A surfaceless EGL context (EGL_MESA_platform_surfaceless, falling back
+ *  to the default display) rendering into a framebuffer object, so the
+ *  renderers run without a window system, e.g. on software Mesa. There is
+ *  no swap and no vsync, so frames can be rendered back to back.
+ *
+ *  Readback is asynchronous: endFrame() queues a glReadPixels into one of
+ *  two pixel pack buffers and returns at once; retrieveFrame() maps the
+ *  buffer of the previous frame, which the GPU has normally finished by
+ *  then, so reading frame N overlaps with rendering frame N+1.
+ *
+ *  Built only with MCV_HAVE_EGL (see CMakeLists.txt); otherwise the
+ *  constructor throws.
+ */
+namespace mcv {
+
+class OffscreenContext
+{
+public:
+    /*! Creates the context and a framebuffer of the given size (colour +
+     *  depth), and makes the context current. Throws cv::Exception if no
+     *  context can be created. */
+    explicit OffscreenContext( const cv::Size& size );
+    ~OffscreenContext();
+
+    /*! True when the library was built with the EGL backend */
+    static bool isAvailable();
+
+    const cv::Size& size() const;
+
+    /*! Makes the context current on the calling thread */
+    void makeCurrent();
+    /*! Binds the framebuffer and sets the viewport to cover it */
+    void beginFrame();
+    /*! Queues the readback of the frame just drawn, without waiting. A frame
+     *  never retrieved is dropped two frames later. */
+    void endFrame();
+    /*! Oldest pending frame as a top-down CV_8UC3 BGR image. Without wait
+     *  only frames older than the last one are returned; with wait the last
+     *  one is too, blocking until it is rendered. False if none is pending. */
+    bool retrieveFrame( cv::Mat& image, bool wait = false );
+
+private:
+    OffscreenContext( const OffscreenContext& );
+    OffscreenContext& operator=( const OffscreenContext& );
+
+    cv::Size     m_size;
+    void*        m_display;     // EGLDisplay
+    void*        m_context;     // EGLContext
+    unsigned int m_framebufferId;
+    unsigned int m_colorBufferId;
+    unsigned int m_depthBufferId;
+    unsigned int m_pixelBufferIds[2];
+    bool         m_isPending[2];
+    int          m_nextBuffer;  // written by the next endFrame
+};
+
+} // mcv
+
+#endif
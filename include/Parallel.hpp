@@ -0,0 +1,88 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __PARALLEL_HPP__
+#define __PARALLEL_HPP__
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/*! Row-band parallel execution
+ *
+ *  Work over an image-like grid is cut into bands of `grain` consecutive
+ *  rows. The band boundaries depend only on the row count and the grain,
+ *  never on the number of threads, and reductions combine the per-band
+ *  partial results in band order, so results are identical whatever the
+ *  thread count. Bands are executed by a persistent pool; the calling
+ *  thread takes part in the work. A parallel call made from inside a band,
+ *  or while another thread is using the pool, runs serially on the caller.
+ */
+namespace mcv {
+
+enum { PARALLEL_DEFAULT_GRAIN = 16 };
+
+/*! Threads used by the parallel loops: 1 runs everything serially on the
+ *  calling thread, 0 (or negative) restores one thread per core */
+void setNumThreads( int threads );
+int getNumThreads();
+
+/*! Number of bands a loop over `rows` rows is cut into */
+int bandCount( int rows, int grain = PARALLEL_DEFAULT_GRAIN );
+
+/*! Runs body(band, beginRow, endRow) once for each band of [0, rows) */
+void parallelForBands( int rows, const std::function<void(int,int,int)>& body,
+                       int grain = PARALLEL_DEFAULT_GRAIN );
+
+/*! Runs body(beginRow, endRow) over bands covering [0, rows) */
+void parallelForRows( int rows, const std::function<void(int,int)>& body,
+                      int grain = PARALLEL_DEFAULT_GRAIN );
+
+/*! Each band accumulates into its own copy of init through
+ *  body(beginRow, endRow, partial); the partials are then folded into
+ *  init with join(result, partial), in band order. */
+template<typename T, typename Body, typename Join>
+T parallelReduceRows( int rows, const T& init, const Body& body, const Join& join,
+                      int grain = PARALLEL_DEFAULT_GRAIN )
+{
+    std::vector<T> partial( bandCount( rows, grain ), init );
+    parallelForBands( rows, [&]( int band, int begin, int end ){
+        body( begin, end, partial[band] );
+    }, grain );
+
+    T result = init;
+    for( std::size_t i=0; i<partial.size(); i++ )
+        join( result, partial[i] );
+    return result;
+}
+
+} // mcv
+
+#endif
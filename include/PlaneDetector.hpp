@@ -0,0 +1,113 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __PLANEDETECTOR_HPP__
+#define __PLANEDETECTOR_HPP__
+
+#include "GeometryTypes.hpp"
+#include "Normals.hpp"
+#include "PointCloud.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+/*! Dominant plane extraction on organized clouds
+ *
+ *  RANSAC with normals: a single point and its normal define a plane
+ *  hypothesis, so hypotheses are cheap and rarely degenerate. They are
+ *  drawn from, and scored on, a subsampled grid (every sampleStep-th pixel
+ *  in both directions) whose normals are estimated at that resolution
+ *  unless the cloud carries a normals plane. Hypotheses are scored in
+ *  parallel; a point supports one when it is close to the plane and its
+ *  normal agrees. The winner is refit by least squares on its inliers over
+ *  the full grid, then the inlier mask is built at full resolution, with
+ *  the same test; without a normals plane, a full resolution point uses
+ *  the normal of the nearest sample.
+ *  Sampling uses a fixed seed, so a frame always gives the same plane.
+ */
+namespace mcv {
+
+struct PlaneModel
+{
+    cv::Vec4f           coefficients;   // (a,b,c,d): a*x+b*y+c*z+d = 0,
+                                        // unit normal facing the camera
+    cv::Vec3f           centroid;       // of the inliers
+    cv::Mat             inliers;        // CV_8UC1 mask aligned with the grid
+    int                 inlierCount;
+    /*! Plane frame in cloud coordinates: origin at the centroid, Z along
+     *  the normal, X along the cloud X axis projected on the plane. Maps
+     *  plane coordinates to cloud coordinates. */
+    mcv::Transformation pose;
+};
+
+class PlaneDetector
+{
+public:
+    PlaneDetector();
+
+    /*! Point to plane distance for inliers (units of the cloud) */
+    void setDistanceThreshold( float distance );
+    float getDistanceThreshold() const;
+    /*! Largest angle between a point normal and the plane normal (radians) */
+    void setAngleThreshold( float angle );
+    float getAngleThreshold() const;
+    void setHypotheses( int hypotheses );
+    int getHypotheses() const;
+    void setSampleStep( int step );
+    int getSampleStep() const;
+    /*! Fraction of the valid points a plane needs to be reported. Both
+     *  counts are at full resolution: the inliers of the final mask
+     *  (inlierCount) over getValidCount() of the cloud. The support on the
+     *  sampled grid only ranks the hypotheses. */
+    void setMinInlierRatio( float ratio );
+    float getMinInlierRatio() const;
+
+    /*! Finds the plane supported by the most points. Returns false when
+     *  none reaches the minimum inlier ratio. */
+    bool detect( const mcv::Point3Cloud& cloud, mcv::PlaneModel& plane );
+
+private:
+    float m_distance;
+    float m_angle;
+    int   m_hypotheses;
+    int   m_step;
+    float m_minRatio;
+
+    mcv::NormalEstimator    m_normalEstimator;
+    cv::Mat                 m_samplePoints;    // subsampled grid
+    cv::Mat                 m_sampleNormals;
+    std::vector<cv::Vec3f>  m_points;          // valid samples
+    std::vector<cv::Vec3f>  m_normals;
+};
+
+} // mcv
+
+#endif
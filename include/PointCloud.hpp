@@ -34,10 +34,27 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include "FrameIO.hpp"
+#include "FrameSequence.hpp"
+
+#include <functional>
 #include <string>
 
-/*! PointCloud class */
+/*! PointCloud class
+ *
+ *  Copy-on-write policy: copying or assigning a cloud shares its buffers,
+ *  and the in-place operations (apply*) copy the XYZ plane first only when
+ *  it is shared with another cloud or wraps memory the cloud does not own
+ *  (e.g. a mapped frame file). Operations that overwrite a whole plane
+ *  (grabFrame, readFrame) allocate a new one instead of writing into a
+ *  shared buffer. clone() and the getData/getBgr copies are explicit deep
+ *  copies; the const& constructors and setters copy their argument, while
+ *  the rvalue overloads take it over.
+ */
 namespace mcv {
+
+class FrameSource;
+class NormalEstimator;
     
 class Point3Cloud
 {
@@ -45,23 +62,75 @@ public:
     /*! Constructors */
     Point3Cloud();
     Point3Cloud( const mcv::Point3Cloud& cloud );
+    Point3Cloud( mcv::Point3Cloud&& cloud );
     Point3Cloud( const cv::Mat& data );
     Point3Cloud( const cv::Mat& data, const cv::Mat& bgr );
+    Point3Cloud( cv::Mat&& data, cv::Mat&& bgr );
     /*! Destructors */
     ~Point3Cloud();
+
+    /*! Cloud back-projected from a depth image (CV_16UC1 or CV_32FC1,
+     *  depthScale units per meter) with the cached rays of the calibration,
+     *  see mcv::backprojectDepth. bgr, if any, is copied. */
+    static Point3Cloud fromDepth( const cv::Mat& depth,
+                                  const mcv::CameraCalibration& calibration,
+                                  const cv::Mat& bgr = cv::Mat(),
+                                  float depthScale = mcv::FRAME_DEPTH_SCALE );
+
+    /*! Assignment (shares buffers, see the copy-on-write policy above) */
+    Point3Cloud& operator=( const mcv::Point3Cloud& cloud );
+    Point3Cloud& operator=( mcv::Point3Cloud&& cloud );
+    /*! Deep copy */
+    Point3Cloud clone() const;
     
     /*! Setters */
     void setData( const cv::Mat& data );
     void setBgr( const cv::Mat& bgr );
+    void setData( cv::Mat&& data );
+    void setBgr( cv::Mat&& bgr );
     
-    /*! Getters */
+    /*! Getters (deep copies) */
     void getData( cv::Mat& data ) const;
     void getBgr( cv::Mat& bgr ) const;
+
+    /*! Read-only views, no copy. Valid until the cloud is next modified */
+    const cv::Mat& getDataView() const;
+    const cv::Mat& getBgrView() const;
+
+    /*! Surface normals, a CV_32FC3 plane aligned with data ((0,0,0) where
+     *  unknown), see mcv::NormalEstimator. Rotated along with the points
+     *  by the apply* transforms, dropped when the points are replaced.
+     *  A pipeline should pass its own estimator, whose integral images are
+     *  then reused frame to frame; the radius overload allocates them for
+     *  the call. */
+    void computeNormals( int radius = 4 );
+    void computeNormals( mcv::NormalEstimator& estimator );
+    bool hasNormals() const;
+    void getNormals( cv::Mat& normals ) const;
+    const cv::Mat& getNormalsView() const;
     
-    /*! Load/Read/Write */
-    void grabFrame( cv::VideoCapture capturer, bool grabColor = true );
-    void readFrame( const std::string &name );
+    /*! Load/Read/Write
+     *  readFrame/writeFrame pick the format from the file extension:
+     *  FRAME_BINARY_EXTENSION (".mcvf") uses the memory-mapped binary
+     *  container, FRAME_COMPRESSED_EXTENSION (".mcvz") the same container
+     *  with 16 bit depth + PNG planes, anything else goes through
+     *  cv::FileStorage (YAML/XML).
+     *  The sequence overloads stream frames in recording order from/to a
+     *  single .mcvs file without reopening it. Binary frames only have
+     *  their checksum verified on request (verify, or the verifyFrames
+     *  flag of the sequence reader), see mcv::decodeFrame.
+     *  grabFrame reads the next frame of an OpenNI capture or of any
+     *  FrameSource (live, synthetic or replayed, see FrameSource.hpp); the
+     *  cloud is left untouched when no frame could be grabbed. */
+    bool grabFrame( cv::VideoCapture& capturer, bool grabColor = true );
+    bool grabFrame( mcv::FrameSource& source, bool grabColor = true, double* timestamp = 0 );
+    void readFrame( const std::string &name, bool verify = false );
     void writeFrame( const std::string &name );
+    bool readFrame( mcv::FrameSequenceReader& sequence, double* timestamp = 0 );
+    void writeFrame( mcv::FrameSequenceWriter& sequence, double timestamp ) const;
+    /*! Serializes the frame in memory, see mcv::encodeFrame */
+    mcv::FrameEncoding encodeFrame( std::vector<uchar>& blob,
+                                    mcv::FrameEncoding encoding = mcv::FRAME_ENCODING_RAW ) const;
     
     /*! Public Methods */
     void applyTransformation( const cv::Matx33f& rotation,
@@ -70,21 +139,93 @@ public:
                         const cv::Matx33f& rotZ );
     void applyTranslation( const cv::Vec3f& translation );
     void displayColor2D( const std::string windowName );
+    /*! Exchanges the buffers of two clouds, no pixel is copied */
+    void swap( mcv::Point3Cloud& other );
 
-    /*! Public data */
-    cv::Vec3f bBCenter;
-    cv::Vec3f bBPmin, bBPmax;
-    float bBDistance;
+    /*! Bounding box of the valid points (see isValidPoint), computed on
+     *  first use and cached until the points change. Rigid transforms keep
+     *  the cache up to date analytically: the centroid follows the motion
+     *  exactly, a translation shifts the box, a rotation only marks the box
+     *  for a rescan on the next access. The lazy update is not thread-safe
+     *  for concurrent readers of a cloud whose bounds are out of date. */
+    const cv::Vec3f& getBBCenter() const;
+    const cv::Vec3f& getBBMin() const;
+    const cv::Vec3f& getBBMax() const;
+    float getBBDistance() const;
+    /*! Number of valid points */
+    size_t getValidCount() const;
+
+    /*! Compact view of the valid points: N x 1 arrays holding the valid
+     *  points (CV_32FC3), their colours (CV_8UC3, empty without a matching
+     *  BGR plane) and their position in the grid (CV_32SC1, row*cols + col),
+     *  in row-major order. Built on first use; once built, the apply*
+     *  transforms only process the valid points and scatter them back into
+     *  the grid, and bounds rescans skip the grid. Dropped when the cloud
+     *  is reloaded or releaseCompact() is called. The references are valid
+     *  until the cloud is next modified. */
+    const cv::Mat& getCompactData() const;
+    const cv::Mat& getCompactBgr() const;
+    const cv::Mat& getCompactIndex() const;
+    bool hasCompact() const;
+    void releaseCompact();
 
 protected:
     /*! Atributes */
     cv::Mat data;
     cv::Mat bgr;
+    cv::Mat normals;
 
 private:
-    void computeCenter();
+    /*! Rescans the valid points, parallel over row bands */
+    void computeBounds() const;
+    /*! Drops the cached bounds, compact view and normals after the points
+     *  were replaced */
+    void invalidateCache();
+    /*! Gathers the valid points into the compact arrays */
+    void buildCompact() const;
+    /*! Runs kernel(points, count) in place over the valid points (compact
+     *  view) or the whole grid, after detaching the XYZ plane */
+    void applyKernel( const std::function<void(float*,size_t)>& kernel );
+    /*! Applies the rotation part of a 3x4 [R|t] to the normals plane */
+    void rotateNormals( const float m[12] );
+    /*! Makes the XYZ plane private to this cloud before writing into it */
+    void detach();
+    /*! Drops shared planes that are about to be overwritten entirely */
+    void releaseShared();
+
+    /*! Keeps a mapped frame file alive while data/bgr point into it */
+    cv::Ptr<mcv::MappedFile> storage;
+
+    /*! Cached bounds */
+    struct Bounds
+    {
+        cv::Vec3f center;
+        cv::Vec3f pmin, pmax;
+        float     distance;
+        size_t    count;
+        bool      centerValid;  // center and count are up to date
+        bool      boxValid;     // pmin, pmax and distance are up to date
+    };
+    mutable Bounds bounds;
+
+    /*! Compact view */
+    struct Compact
+    {
+        cv::Mat points;
+        cv::Mat bgr;
+        cv::Mat index;
+        bool    valid;
+    };
+    mutable Compact compact;
 };
 
+/*! False for the pixels the sensor could not measure: OpenNI reports them
+ *  at the origin, other sources as NaN */
+inline bool isValidPoint( const cv::Vec3f& P ){
+    return ( P[0] != 0.f || P[1] != 0.f || P[2] != 0.f ) &&
+           P[0] == P[0] && P[1] == P[1] && P[2] == P[2];
+}
+
 } // mcv
 
 #endif
@@ -9,6 +9,7 @@
 
 #include "PointCloud.hpp"
 #include "GeometryTypes.hpp"
+#include "OffscreenContext.hpp"
 #include <opencv2/opencv.hpp>
 
 namespace mcv {
@@ -18,13 +19,26 @@ class PointCloudViewer
 {
 public:
     PointCloudViewer(std::string windowName, cv::Size frameSize);
+    //! Headless: renders into the framebuffer of offscreen, which must
+    //! outlive the viewer
+    explicit PointCloudViewer(OffscreenContext& offscreen);
     ~PointCloudViewer();
 
+    //! Shares the cloud buffers (copy-on-write), or takes them over. The
+    //! valid points are uploaded to vertex buffers on the next redraw
     void updatePointCloud(const mcv::Point3Cloud& cloud);
+    void updatePointCloud(mcv::Point3Cloud&& cloud);
+    //! Redraws the window, or renders a frame offscreen and queues its readback
     void updateWindow();
+    //! Headless only: the oldest rendered frame, see OffscreenContext::retrieveFrame
+    bool retrieveFrame(cv::Mat& image, bool wait = false);
 
 private:
+    PointCloudViewer(OffscreenContext* offscreen, const std::string& windowName, cv::Size frameSize);
+
     friend void PointCloudViewerDrawCallback(void* param);
+    //! Makes the window or offscreen context current
+    void makeCurrent();
     //! Render entire scene in the OpenGl window
     void draw();
 
@@ -32,12 +46,25 @@ private:
     void drawScene();
     void drawPointCloud();
 
+    //! Copies the valid points, colours (RGB) and normals of the cloud to
+    //! the vertex buffers
+    void uploadPointCloud();
+
 private:
     bool m_isTextureInitialized;
     unsigned int m_backgroundTextureId;
+    bool m_areBuffersInitialized;
+    bool m_isCloudUploaded;
+    unsigned int m_vertexBufferId;
+    unsigned int m_colorBufferId;
+    unsigned int m_normalBufferId;
+    int m_vertexCount;
+    bool m_hasColors;
+    bool m_hasNormals;
     mcv::Point3Cloud m_pointCloud;
     std::string m_windowName;
     cv::Size size;
+    OffscreenContext* m_offscreen;
 };
 }// mcv
 #endif
@@ -0,0 +1,85 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __POINTKERNELS_HPP__
+#define __POINTKERNELS_HPP__
+
+#include <cstddef>
+#include <stdint.h>
+
+/*! Vectorized kernels over packed XYZ float buffers (x0 y0 z0 x1 y1 ...)
+ *
+ *  Every kernel has a scalar, an SSE2 and an AVX2 implementation; the
+ *  widest one supported by the CPU is picked at run time. The SIMD paths
+ *  evaluate the same operations in the same order as the scalar path (no
+ *  FMA contraction), so their results are bit-identical.
+ *
+ *  Points at the origin, which is how OpenNI marks pixels without depth,
+ *  are left at the origin so that they stay recognizable as invalid after
+ *  a transform.
+ */
+namespace mcv {
+
+enum KernelIsa { KERNEL_SCALAR = 0,
+                 KERNEL_SSE2   = 1,
+                 KERNEL_AVX2   = 2 };
+
+/*! Instruction set used by the kernels */
+KernelIsa kernelIsa();
+/*! Best instruction set supported by this CPU */
+KernelIsa detectKernelIsa();
+/*! Restricts the kernels to an instruction set, e.g. to compare paths;
+ *  requests above detectKernelIsa() are clamped */
+void setKernelIsa( KernelIsa isa );
+
+/*! dst = R*src + t for count points, m being the row-major 3x4 [R|t].
+ *  src and dst may be the same buffer. */
+void transformPoints( const float* src, float* dst, size_t count, const float m[12] );
+
+/*! dst = src + t for count points. src and dst may be the same buffer. */
+void translatePoints( const float* src, float* dst, size_t count, const float t[3] );
+
+/*! dst = rays*(depth*scale) for count pixels, rays being packed XYZ ray
+ *  directions with unit Z. A zero depth gives a point at the origin. */
+void backprojectDepth( const uint16_t* depth, const float* rays, float* dst,
+                       size_t count, float scale );
+void backprojectDepth( const float* depth, const float* rays, float* dst,
+                       size_t count, float scale );
+
+/*! Pinhole projection of count points to packed pixels (u0 v0 u1 ...)
+ *  after the rigid transform m (row-major [R|t]), with the model of
+ *  cv::projectPoints. camera holds fx, fy, cx, cy, k1, k2, p1, p2, k3. A
+ *  point at Z = 0 is divided by 1, as cv::projectPoints does. */
+void projectPoints( const float* src, float* dst, size_t count,
+                    const float m[12], const float camera[9] );
+
+} // mcv
+
+#endif
@@ -0,0 +1,216 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __PROFILER_HPP__
+#define __PROFILER_HPP__
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*! Frame timing instrumentation
+ *
+ *  Stages are named code regions timed with scoped timers:
+ *
+ *      MCV_PROFILE_SCOPE("Point3Cloud::grabFrame");
+ *      MCV_PROFILE_GPU_SCOPE("DrawingContext::drawCameraFrame", this);
+ *
+ *  Each stage keeps a log-linear latency histogram (8 sub-buckets per power
+ *  of two nanoseconds, so percentiles are within 1/16 of the true value)
+ *  updated with relaxed atomics; recording never locks unless tracing is
+ *  on. GPU stages use GL timestamp queries that are read back without
+ *  stalling by MCV_PROFILE_GPU_COLLECT(owner) on a later frame; owner tags
+ *  the GL context the queries belong to (the renderer).
+ *
+ *  The macros expand to nothing unless MCV_ENABLE_PROFILING is defined (the
+ *  CMake option of the same name), so instrumented code costs nothing in
+ *  normal builds. The Profiler itself is always available.
+ */
+namespace mcv {
+
+enum { PROFILE_MAX_STAGES     = 128,
+       PROFILE_BUCKETS        = 512,
+       PROFILE_MAX_TRACE      = 1<<20 };   // trace events kept
+
+/*! Snapshot of one stage, times in milliseconds */
+struct ProfileStats
+{
+    std::string name;
+    uint64_t    count;
+    double      mean;
+    double      p50, p95, p99;
+    double      max;
+};
+
+class Profiler
+{
+public:
+    static Profiler& instance();
+    ~Profiler();
+
+    /*! Id of a stage, registered on first use. Throws once
+     *  PROFILE_MAX_STAGES stages exist. */
+    int stage( const std::string& name );
+
+    /*! Adds one measurement; start is on the clock of now() */
+    void record( int stage, int64_t startNs, int64_t durationNs, bool gpu = false );
+
+    /*! Monotonic clock used by the timers, in nanoseconds */
+    static int64_t now();
+
+    /*! Chrome trace recording (off by default) */
+    void setTracing( bool enabled );
+    bool isTracing() const;
+
+    /*! Clears every histogram and the trace, keeping the stages */
+    void reset();
+
+    std::vector<ProfileStats> snapshot() const;
+    /*! stage,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms */
+    void writeCsv( const std::string& name ) const;
+    /*! {"stages":[{"name":...,"count":...,"mean_ms":...},...]} */
+    void writeJson( const std::string& name ) const;
+    /*! Trace Event Format, for chrome://tracing or Perfetto. GPU events are
+     *  placed at the CPU time their scope started, on their own track. */
+    void writeChromeTrace( const std::string& name ) const;
+
+    /*! GPU timers: a pair of timestamp queries per scope */
+    void beginGpu( int stage, const void* owner, unsigned int queries[2], int64_t& cpuStart );
+    void endGpu( int stage, const void* owner, const unsigned int queries[2], int64_t cpuStart );
+    /*! Records the GPU scopes of owner whose results are available. Must
+     *  run with the GL context of owner current. */
+    void collectGpu( const void* owner );
+
+private:
+    Profiler();
+    Profiler( const Profiler& );
+    Profiler& operator=( const Profiler& );
+
+    struct Stage
+    {
+        std::string           name;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> totalNs;
+        std::atomic<uint64_t> maxNs;
+        std::atomic<uint64_t> buckets[PROFILE_BUCKETS];
+    };
+
+    struct TraceEvent
+    {
+        int     stage;
+        int     thread;     // 0 for GPU events
+        int64_t startNs;
+        int64_t durationNs;
+    };
+
+    struct GpuScope
+    {
+        int          stage;
+        const void*  owner;
+        unsigned int queries[2];
+        int64_t      cpuStart;
+    };
+
+    Stage*                  m_stages[PROFILE_MAX_STAGES];
+    std::atomic<int>        m_stageCount;
+    mutable std::mutex      m_stageMutex;
+
+    std::atomic<bool>       m_tracing;
+    int64_t                 m_origin;       // trace time zero
+    mutable std::mutex      m_traceMutex;
+    std::vector<TraceEvent> m_trace;
+
+    std::mutex              m_gpuMutex;
+    std::vector<GpuScope>   m_gpuPending;
+};
+
+/*! Times the enclosing scope on the CPU */
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer( int stage )
+      : m_stage(stage)
+      , m_start(Profiler::now()){
+    }
+    ~ScopedTimer(){
+        Profiler::instance().record( m_stage, m_start, Profiler::now() - m_start );
+    }
+
+private:
+    int     m_stage;
+    int64_t m_start;
+};
+
+/*! Times the GL commands issued in the enclosing scope */
+class ScopedGpuTimer
+{
+public:
+    ScopedGpuTimer( int stage, const void* owner )
+      : m_stage(stage)
+      , m_owner(owner){
+        Profiler::instance().beginGpu( m_stage, m_owner, m_queries, m_cpuStart );
+    }
+    ~ScopedGpuTimer(){
+        Profiler::instance().endGpu( m_stage, m_owner, m_queries, m_cpuStart );
+    }
+
+private:
+    int          m_stage;
+    const void*  m_owner;
+    unsigned int m_queries[2];
+    int64_t      m_cpuStart;
+};
+
+} // mcv
+
+#define MCV_PROFILE_CONCAT_(a, b) a##b
+#define MCV_PROFILE_CONCAT(a, b) MCV_PROFILE_CONCAT_(a, b)
+
+#ifdef MCV_ENABLE_PROFILING
+#define MCV_PROFILE_SCOPE(name)                                                          \
+    static const int MCV_PROFILE_CONCAT(mcvProfileStage, __LINE__) =                     \
+        mcv::Profiler::instance().stage(name);                                           \
+    mcv::ScopedTimer MCV_PROFILE_CONCAT(mcvProfileTimer, __LINE__)(                      \
+        MCV_PROFILE_CONCAT(mcvProfileStage, __LINE__) )
+#define MCV_PROFILE_GPU_SCOPE(name, owner)                                               \
+    static const int MCV_PROFILE_CONCAT(mcvProfileGpuStage, __LINE__) =                  \
+        mcv::Profiler::instance().stage(std::string(name) + " (gpu)");                   \
+    mcv::ScopedGpuTimer MCV_PROFILE_CONCAT(mcvProfileGpuTimer, __LINE__)(                \
+        MCV_PROFILE_CONCAT(mcvProfileGpuStage, __LINE__), owner )
+#define MCV_PROFILE_GPU_COLLECT(owner) mcv::Profiler::instance().collectGpu(owner)
+#else
+#define MCV_PROFILE_SCOPE(name)
+#define MCV_PROFILE_GPU_SCOPE(name, owner)
+#define MCV_PROFILE_GPU_COLLECT(owner)
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __REGISTRATION_HPP__
+#define __REGISTRATION_HPP__
+
+#include "CameraCalibration.hpp"
+#include "GeometryTypes.hpp"
+#include "Normals.hpp"
+#include "PointCloud.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+/*! Rigid registration of organized clouds
+ *
+ *  Point-to-plane ICP with projective data association: every valid source
+ *  point, moved by the current estimate, is projected into the target
+ *  image with the target intrinsics and paired with the target point and
+ *  normal found at that pixel, so no search structure is needed. Pairs
+ *  further apart than the correspondence distance are rejected.
+ *
+ *  Iterations run coarse to fine: the first levels only use every 4th,
+ *  2nd... source pixel, the last one uses them all. A level ends early
+ *  once the update falls below the convergence thresholds. The 6x6 normal
+ *  equations of each iteration are accumulated in parallel row bands and
+ *  folded in band order, so results do not depend on the thread count.
+ */
+namespace mcv {
+
+/*! Residual report of one iteration */
+struct IcpIteration
+{
+    int    level;               // 0 is the finest
+    int    iteration;           // within the level
+    int    correspondences;
+    double rmse;                // point-to-plane, before the update
+    double timeMs;
+};
+
+struct IcpResult
+{
+    mcv::Transformation transformation;  // source -> target
+    bool   converged;                    // finest level met the thresholds
+    int    correspondences;              // of the last iteration
+    double rmse;                         // of the last iteration
+    std::vector<IcpIteration> iterations;
+};
+
+class IcpRegistration
+{
+public:
+    IcpRegistration();
+
+    /*! Intrinsics of the target clouds. When not set, they are estimated
+     *  from the first target with estimateCalibration and kept. */
+    void setCalibration( const mcv::CameraCalibration& calibration );
+    bool hasCalibration() const;
+    const mcv::CameraCalibration& getCalibration() const;
+
+    /*! Normal estimation for targets without a normals plane */
+    mcv::NormalEstimator& normalEstimator();
+
+    /*! Iterations per level, finest first: {4, 5, 10} runs 10 iterations
+     *  on every 4th pixel, then 5 on every 2nd, then 4 on all of them */
+    void setIterations( const std::vector<int>& iterationsPerLevel );
+    const std::vector<int>& getIterations() const;
+
+    /*! Pairs further apart are rejected (units of the clouds) */
+    void setMaxCorrespondenceDistance( float distance );
+    float getMaxCorrespondenceDistance() const;
+
+    /*! A level stops once the rotation update (radians) and the
+     *  translation update both fall below these */
+    void setConvergence( float rotation, float translation );
+
+    /*! Transformation that, applied to source, aligns it with target.
+     *  Both clouds must be organized CV_32FC3 grids. The normals plane of
+     *  the target is used when present, otherwise normals are estimated
+     *  with the estimator below on every call. */
+    mcv::IcpResult align( const mcv::Point3Cloud& source, const mcv::Point3Cloud& target,
+                          const mcv::Transformation& guess = mcv::Transformation() );
+
+private:
+    mcv::CameraCalibration m_calibration;
+    bool                   m_hasCalibration;
+    std::vector<int>       m_iterations;
+    float                  m_maxDistance;
+    float                  m_minRotation;
+    float                  m_minTranslation;
+
+    mcv::NormalEstimator   m_normalEstimator;
+    cv::Mat                m_normals;    // estimated target normals
+};
+
+} // mcv
+
+#endif
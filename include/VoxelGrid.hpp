@@ -0,0 +1,81 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#ifndef __VOXELGRID_HPP__
+#define __VOXELGRID_HPP__
+
+#include "PointCloud.hpp"
+
+#include <opencv2/opencv.hpp>
+
+/*! Voxel-grid downsampling
+ *
+ *  Space is cut into axis-aligned boxes of the leaf size, anchored at the
+ *  minimum corner of the cloud's bounding box, and every occupied box is
+ *  replaced by the centroid of its points, with their mean colour. Only the
+ *  valid points are considered. The result is an unorganized N x 1 cloud,
+ *  so it can be transformed, written or displayed like any other cloud.
+ *
+ *  Voxels are keyed by their packed integer coordinates and accumulated in
+ *  hash tables, one per key partition, each partition being filled by its
+ *  own thread from the points a counting sort assigned to it. Output
+ *  voxels are ordered by partition then first point, which depends only
+ *  on the input, not on the thread count.
+ */
+namespace mcv {
+
+class VoxelGridFilter
+{
+public:
+    /*! leafSize in the units of the cloud (meters for OpenNI) */
+    explicit VoxelGridFilter( float leafSize = 0.01f );
+    explicit VoxelGridFilter( const cv::Vec3f& leafSize );
+
+    void setLeafSize( float leafSize );
+    void setLeafSize( const cv::Vec3f& leafSize );
+    const cv::Vec3f& getLeafSize() const;
+
+    /*! Voxels with fewer points are dropped (isolated noise) */
+    void setMinPointsPerVoxel( int minPoints );
+    int getMinPointsPerVoxel() const;
+
+    /*! Downsamples input into output; both may be the same cloud. Throws
+     *  cv::Exception when the leaf is too small for the extent of the cloud
+     *  (more than 2^21 voxels along an axis). */
+    void filter( const mcv::Point3Cloud& input, mcv::Point3Cloud& output ) const;
+
+private:
+    cv::Vec3f m_leafSize;
+    int       m_minPoints;
+};
+
+} // mcv
+
+#endif
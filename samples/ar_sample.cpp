@@ -35,6 +35,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // mcv //
 #include "PointCloud.hpp"
 #include "DrawingContext.hpp"
+#include "PlaneDetector.hpp"
 // cv/gl //
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -45,15 +46,45 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 using namespace cv;
 using namespace std;
 
+/*! Puts the pattern on a detected plane: the plane frame is moved from
+ *  cloud coordinates to the GL eye frame of the drawer (x right, y up,
+ *  z backward). getMat44 hands the rotation to GL as is, so the pose
+ *  rotation is the transpose of the eye frame rotation. */
+static void planeToEye( const mcv::PlaneModel& plane, const mcv::CameraCalibration& calibration,
+                        cv::Matx33f& R, cv::Vec3f& T ){
+    const cv::Vec3f S( calibration.fx() < 0 ? -1.f : 1.f, calibration.fy() < 0 ? 1.f : -1.f, -1.f );
+    const cv::Matx33f& P = plane.pose.r();
+    cv::Vec3f x( S[0]*P(0,0), S[1]*P(1,0), S[2]*P(2,0) );
+    cv::Vec3f z( S[0]*P(0,2), S[1]*P(1,2), S[2]*P(2,2) );
+    cv::Vec3f y = z.cross(x);
+    R = cv::Matx33f( x[0], x[1], x[2],
+                     y[0], y[1], y[2],
+                     z[0], z[1], z[2] );
+    T = cv::Vec3f( S[0]*plane.centroid[0], S[1]*plane.centroid[1], S[2]*plane.centroid[2] );
+}
+
 
 int main( int argc, char * argv[] ){
 
     mcv::Point3Cloud mypc;
     cv::Mat bgrImage;
     mcv::CameraCalibration calibration(1000.0f, 1500.0f, 333.33f, 200.0f);
+    mcv::CameraCalibration cloudCalibration;
+    bool calibrated = false;
+    if (argc>1){
+        mypc.readFrame(argv[1]);
+        mypc.getBgr(bgrImage);
+        calibrated = mcv::estimateCalibration(mypc.getDataView(), cloudCalibration);
+        if (calibrated)
+            calibration = mcv::CameraCalibration(std::fabs(cloudCalibration.fx()), std::fabs(cloudCalibration.fy()),
+                                                 cloudCalibration.cx(), cloudCalibration.cy());
+    }
     mcv::DrawingContext drawer("MCV AR", cv::Size(640,480), calibration);
-    cv::Matx33f myR( 1, 0.0, 0.0, -0.0, 1.0, -0.0, -0.0, 0.0, 1.0 );
+    cv::Matx33f planeR( 1, 0.0, 0.0, -0.0, 1.0, -0.0, -0.0, 0.0, 1.0 );
+    cv::Matx33f myR = planeR;
     cv::Vec3f myT(0.0,-0.0,-10);
+    mcv::PlaneDetector detector;
+    mcv::PlaneModel plane;
     drawer.isPatternPresent = true;
     drawer.patternPose = mcv::Transformation( myR, myT );
 
@@ -63,14 +94,28 @@ int main( int argc, char * argv[] ){
     float angY=0.0;
     float angZ=0.0;
 
-    if (argc>1){
-        mypc.readFrame(argv[1]);
-        mypc.getBgr(bgrImage);
+    bool detect = calibrated;
 
+    if (argc>1){
         while (loop){
+            if (detect){
+                detect = false;
+                int64 start = cv::getTickCount();
+                bool found = detector.detect(mypc, plane);
+                double ms = (cv::getTickCount() - start)*1000./cv::getTickFrequency();
+                if (found){
+                    std::cout<<"Plane "<<plane.coefficients<<" ("<<plane.inlierCount<<" points, "<<ms<<" ms)"<<std::endl;
+                    planeToEye(plane, cloudCalibration, planeR, myT);
+                    angY = angZ = 0.0;
+                    myR = planeR;
+                }else{
+                    std::cout<<"No plane found ("<<ms<<" ms)"<<std::endl;
+                }
+            }
+
             if (!bgrImage.empty()){
-                cv::Mat img = bgrImage.clone();
-                drawer.updateBackground(img);
+                // Only referenced until the next redraw, bgrImage is never written
+                drawer.updateBackground(bgrImage);
 
                 int keyCode = cv::waitKey(30);
                 //if (keyCode>0) std::cout<<keyCode<<std::endl;
@@ -97,7 +142,7 @@ int main( int argc, char * argv[] ){
                                       -sin(angY),0,cos(angY))*
                               Matx33f(1,0,0,
                                       0,cos(angZ),-sin(angZ),
-                                      0,sin(angZ),cos(angZ));
+                                      0,sin(angZ),cos(angZ))*planeR;
                         break;
 
                     case 'd':
@@ -108,7 +153,7 @@ int main( int argc, char * argv[] ){
                                       -sin(angY),0,cos(angY))*
                               Matx33f(1,0,0,
                                       0,cos(angZ),-sin(angZ),
-                                      0,sin(angZ),cos(angZ));
+                                      0,sin(angZ),cos(angZ))*planeR;
                         break;
 
                     case 'q':
@@ -119,7 +164,7 @@ int main( int argc, char * argv[] ){
                                       -sin(angY),0,cos(angY))*
                               Matx33f(1,0,0,
                                       0,cos(angZ),-sin(angZ),
-                                      0,sin(angZ),cos(angZ));
+                                      0,sin(angZ),cos(angZ))*planeR;
                         break;
 
                     case 'e':
@@ -130,7 +175,12 @@ int main( int argc, char * argv[] ){
                                       -sin(angY),0,cos(angY))*
                               Matx33f(1,0,0,
                                       0,cos(angZ),-sin(angZ),
-                                      0,sin(angZ),cos(angZ));
+                                      0,sin(angZ),cos(angZ))*planeR;
+                        break;
+
+                    case 'p':
+                    case 'P':
+                        detect = calibrated;
                         break;
 
                     case 65361: // LEFT ARROW
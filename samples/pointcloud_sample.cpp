@@ -53,6 +53,7 @@ int main( int argc, char * argv[] ){
     mcv::Point3Cloud mypc;
     mcv::PointCloudViewer view("MCV AR", cv::Size(640,480));
     if (argc>1) mypc.readFrame(argv[1]);
+    mypc.computeNormals(); // lighting in the viewer
 
     cv::Mat color;
     mypc.getBgr(color);
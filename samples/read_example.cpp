@@ -48,6 +48,17 @@ int main( int argc, char * argv[] )
     mcv::Point3Cloud pc;
             
     for (int i=1; i<argc; i++){
+        if (mcv::fileExtension(argv[i]) == mcv::FRAME_SEQUENCE_EXTENSION){
+            // Play the whole recording, 'q' skips to the next file
+            mcv::FrameSequenceReader sequence(argv[i]);
+            while( pc.readFrame(sequence) ){
+                pc.displayColor2D(" COLOR INFO ");
+                if ( waitKey(30)=='q' )
+                    break;
+            }
+            continue;
+        }
+
         pc.readFrame(argv[i]);
         pc.displayColor2D(" COLOR INFO ");
 
@@ -30,6 +30,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 // MCV
 #include "PointCloud.hpp"
+#include "CaptureEngine.hpp"
+#include "FrameSource.hpp"
+#include "AsyncFrameWriter.hpp"
 
 // OpenCV
 #include <opencv2/opencv.hpp>
@@ -43,32 +46,66 @@ using namespace cv;
 using namespace std;
 
 
-int main( /*int argc, char * argv[]*/ )
+int main( int argc, char * argv[] )
 {
-    VideoCapture capture( CV_CAP_OPENNI );
+    // Frames come from the Kinect, or from a generated scene (--synthetic)
+    // or a recording (--replay file.mcvs) when there is no sensor
+    cv::Ptr<mcv::FrameSource> source( new mcv::OpenNIFrameSource( CV_CAP_OPENNI ) );
+    const char* output = 0;
+    for (int i=1; i<argc; i++){
+        if (string(argv[i]) == "--synthetic")
+            source = cv::Ptr<mcv::FrameSource>( new mcv::SyntheticFrameSource() );
+        else if (string(argv[i]) == "--replay" && i+1<argc)
+            source = cv::Ptr<mcv::FrameSource>( new mcv::ReplayFrameSource(argv[++i]) );
+        else
+            output = argv[i];
+    }
+
+    // The source is grabbed on its own thread, this loop only consumes
+    mcv::CaptureEngine capture( source );
     mcv::Point3Cloud pc;
     
-    if (capture.isOpened()){
-        capture.set( CV_CAP_OPENNI_IMAGE_GENERATOR_OUTPUT_MODE, CV_CAP_OPENNI_VGA_30HZ );
+    if (capture.start()){
+        // Saving happens on worker threads, the loop never waits on the disk
+        mcv::AsyncFrameWriter snapshots;
+
+        // Optional recording: every grabbed frame is appended to output
+        cv::Ptr<mcv::FrameSequenceWriter> recording;
+        cv::Ptr<mcv::AsyncFrameWriter> recorder;
+        if (output){
+            recording = cv::Ptr<mcv::FrameSequenceWriter>( new mcv::FrameSequenceWriter(output) );
+            recorder = cv::Ptr<mcv::AsyncFrameWriter>( new mcv::AsyncFrameWriter(*recording) );
+        }
         
         int cont=0;
         for (;;){
-            pc.grabFrame( capture );
-            pc.displayColor2D(" COLOR INFO ");
+            double timestamp;
+            bool fresh = capture.next( pc, 30, &timestamp );
+            if ( fresh )
+                pc.displayColor2D(" COLOR INFO ");
 
-            int key = waitKey(30);
+            int key = waitKey(1);
 
             if (key == 'q'){
                 break;
             }
 
-            if (key == 'n'){
+            if (fresh && key == 'n'){
                 cont++;
                 char text[50];
-                sprintf(text, "PointCloudTest%d.yml", cont);
-                pc.writeFrame(text);
+                sprintf(text, "PointCloudTest%d.mcvf", cont);
+                mcv::Point3Cloud snapshot( pc );
+                snapshots.write( snapshot, text );
             }
+
+            // Hands the buffers over, pc comes back recycled
+            if (fresh && !recorder.empty())
+                recorder->write( pc, timestamp );
         }
+
+        mcv::CaptureStats stats = capture.stats();
+        cout << stats.captured << " frames captured, " << stats.dropped << " dropped, "
+             << stats.meanLatencyMs << " ms mean latency" << endl;
     }
     
     return 0;
@@ -0,0 +1,214 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "AsyncFrameWriter.hpp"
+
+#include <algorithm>
+
+namespace mcv {
+
+AsyncFrameWriter::AsyncFrameWriter( size_t workers, size_t queueSize )
+  : m_sequence(0)
+  , m_encoding(FRAME_ENCODING_RAW)
+  , m_capacity( std::max<size_t>( queueSize, 1 ) )
+  , m_inFlight(0)
+  , m_nextOrder(0)
+  , m_stopping(false)
+  , m_nextCommit(0){
+    startWorkers( workers );
+}
+
+AsyncFrameWriter::AsyncFrameWriter( FrameSequenceWriter& sequence, FrameEncoding encoding,
+                                    size_t workers, size_t queueSize )
+  : m_sequence(&sequence)
+  , m_encoding(encoding)
+  , m_capacity( std::max<size_t>( queueSize, 1 ) )
+  , m_inFlight(0)
+  , m_nextOrder(0)
+  , m_stopping(false)
+  , m_nextCommit(0){
+    startWorkers( workers );
+}
+
+AsyncFrameWriter::~AsyncFrameWriter(){
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stopping = true;
+    }
+    m_work.notify_all();
+    for( size_t i=0; i<m_workers.size(); i++ )
+        m_workers[i].join();
+}
+
+void AsyncFrameWriter::startWorkers( size_t workers ){
+    m_stats = AsyncWriterStats();
+    workers = std::max<size_t>( workers, 1 );
+    for( size_t i=0; i<workers; i++ )
+        m_workers.push_back( std::thread( &AsyncFrameWriter::run, this ) );
+}
+
+void AsyncFrameWriter::write( Point3Cloud& cloud, const std::string& name ){
+    CV_Assert( !m_sequence );
+    submit( cloud, name, 0.0, true );
+}
+
+bool AsyncFrameWriter::tryWrite( Point3Cloud& cloud, const std::string& name ){
+    CV_Assert( !m_sequence );
+    return submit( cloud, name, 0.0, false );
+}
+
+void AsyncFrameWriter::write( Point3Cloud& cloud, double timestamp ){
+    CV_Assert( m_sequence );
+    submit( cloud, std::string(), timestamp, true );
+}
+
+bool AsyncFrameWriter::tryWrite( Point3Cloud& cloud, double timestamp ){
+    CV_Assert( m_sequence );
+    return submit( cloud, std::string(), timestamp, false );
+}
+
+bool AsyncFrameWriter::submit( Point3Cloud& cloud, const std::string& name,
+                               double timestamp, bool wait ){
+    std::unique_lock<std::mutex> lock( m_mutex );
+    if ( m_inFlight >= m_capacity ){
+        if ( !wait ){
+            m_stats.rejected++;
+            return false;
+        }
+        int64 start = cv::getTickCount();
+        m_room.wait( lock, [this]{ return m_inFlight < m_capacity; } );
+        m_stats.blockedMs += ( cv::getTickCount() - start )*1000.0 / cv::getTickFrequency();
+    }
+
+    m_queue.emplace_back();
+    Job& job = m_queue.back();
+    job.cloud.swap( cloud );
+    if ( !m_free.empty() ){
+        cloud.swap( m_free.back() );
+        m_free.pop_back();
+    }
+    job.name      = name;
+    job.timestamp = timestamp;
+    job.order     = m_nextOrder++;
+
+    m_inFlight++;
+    m_stats.submitted++;
+    lock.unlock();
+    m_work.notify_one();
+    return true;
+}
+
+void AsyncFrameWriter::run(){
+    std::vector<uchar> blob;
+    for(;;){
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_work.wait( lock, [this]{ return !m_queue.empty() || m_stopping; } );
+            if ( m_queue.empty() )
+                return;     // stopping and drained
+
+            Job& front = m_queue.front();
+            job.cloud.swap( front.cloud );
+            job.name.swap( front.name );
+            job.timestamp = front.timestamp;
+            job.order     = front.order;
+            m_queue.pop_front();
+        }
+
+        process( job, blob );
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_free.emplace_back();
+            m_free.back().swap( job.cloud );
+            m_inFlight--;
+        }
+        m_room.notify_all();
+    }
+}
+
+void AsyncFrameWriter::process( Job& job, std::vector<uchar>& blob ){
+    std::string error;
+    try {
+        if ( m_sequence )
+            job.cloud.encodeFrame( blob, m_encoding );
+        else
+            job.cloud.writeFrame( job.name );
+    } catch( const std::exception& e ){
+        error = e.what();
+    }
+
+    if ( m_sequence ){
+        // Encoding ran in parallel, appending follows the submission order
+        std::unique_lock<std::mutex> lock( m_commitMutex );
+        m_turn.wait( lock, [&]{ return m_nextCommit == job.order; } );
+        if ( error.empty() ){
+            try {
+                m_sequence->writeEncoded( blob, job.timestamp );
+            } catch( const std::exception& e ){
+                error = e.what();
+            }
+        }
+        m_nextCommit++;
+        lock.unlock();
+        m_turn.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( error.empty() ){
+        m_stats.written++;
+    } else {
+        m_stats.failed++;
+        m_lastError = error;
+    }
+}
+
+void AsyncFrameWriter::flush(){
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_room.wait( lock, [this]{ return m_inFlight == 0; } );
+}
+
+size_t AsyncFrameWriter::pending() const{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_inFlight;
+}
+
+AsyncWriterStats AsyncFrameWriter::stats() const{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_stats;
+}
+
+std::string AsyncFrameWriter::lastError() const{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_lastError;
+}
+
+} // mcv
@@ -5,7 +5,16 @@
 *****************************************************************************/
 
 #include "CameraCalibration.hpp"
+#include "Parallel.hpp"
+#include "PointKernels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
 namespace mcv {
+
+enum { PROJECT_BLOCK = 4096 };  // points per parallel block in project()
+
 CameraCalibration::CameraCalibration()
 {
 }
@@ -38,6 +47,20 @@ CameraCalibration::CameraCalibration(float _fx, float _fy, float _cx, float _cy,
         m_distortion(i) = distorsionCoeff[i];
 }
 
+void CameraCalibration::getMatrix34(float cparam[3][4]) const
+{
+    for (int i=0; i<3; i++)
+    {
+        for (int j=0; j<3; j++)
+            cparam[i][j] = (i == 2) ? float(j == 2) : 0.f;
+        cparam[i][3] = 0.f;
+    }
+    cparam[0][0] = fx();
+    cparam[1][1] = fy();
+    cparam[0][2] = cx();
+    cparam[1][2] = cy();
+}
+
 const cv::Matx33f& CameraCalibration::getIntrinsic() const
 {
     return m_intrinsic;
@@ -50,12 +73,12 @@ const cv::Mat_<float>&  CameraCalibration::getDistorsion() const
 
 float& CameraCalibration::fx()
 {
-    return m_intrinsic(1,1);
+    return m_intrinsic(0,0);
 }
 
 float& CameraCalibration::fy()
 {
-    return m_intrinsic(0,0);
+    return m_intrinsic(1,1);
 }
 
 float& CameraCalibration::cx()
@@ -70,12 +93,12 @@ float& CameraCalibration::cy()
 
 float CameraCalibration::fx() const
 {
-    return m_intrinsic(1,1);
+    return m_intrinsic(0,0);
 }
 
 float CameraCalibration::fy() const
 {
-    return m_intrinsic(0,0);
+    return m_intrinsic(1,1);
 }
 
 float CameraCalibration::cx() const
@@ -88,4 +111,239 @@ float CameraCalibration::cy() const
     return m_intrinsic(1,2);
 }
 
+void CameraCalibration::snapshot(float params[9]) const
+{
+    params[0] = fx();
+    params[1] = fy();
+    params[2] = cx();
+    params[3] = cy();
+    for (int i=0; i<5; i++)
+        params[4+i] = m_distortion.empty() ? 0.f : m_distortion(i);
+}
+
+static bool isDistorted(const float params[9])
+{
+    for (int i=4; i<9; i++)
+        if (params[i] != 0.f)
+            return true;
+    return false;
+}
+
+static cv::Mat cameraMatrix(const float params[9])
+{
+    cv::Mat_<float> K(3, 3, 0.f);
+    K(0,0) = params[0];
+    K(1,1) = params[1];
+    K(0,2) = params[2];
+    K(1,2) = params[3];
+    K(2,2) = 1;
+    return K;
+}
+
+const cv::Mat& CameraCalibration::getRays(const cv::Size& size) const
+{
+    float params[9];
+    snapshot(params);
+    if (!m_rays.rays.empty() && m_rays.size == size &&
+        std::memcmp(params, m_rays.params, sizeof(params)) == 0)
+        return m_rays.rays;
+
+    // A new matrix, copies of the calibration may still share the old one
+    cv::Mat rays(size, CV_32FC3);
+    if (!isDistorted(params))
+    {
+        for (int i=0; i<size.height; i++)
+        {
+            cv::Vec3f* ray = rays.ptr<cv::Vec3f>(i);
+            float y = (i - params[3]) / params[1];
+            for (int j=0; j<size.width; j++)
+                ray[j] = cv::Vec3f((j - params[2]) / params[0], y, 1.f);
+        }
+    }
+    else
+    {
+        cv::Mat pixels(size.area(), 1, CV_32FC2), normalized;
+        for (int i=0; i<size.height; i++)
+            for (int j=0; j<size.width; j++)
+                pixels.at<cv::Vec2f>(i*size.width + j) = cv::Vec2f(float(j), float(i));
+
+        cv::Mat distortion(5, 1, CV_32F, params + 4);
+        cv::undistortPoints(pixels, normalized, cameraMatrix(params), distortion);
+
+        for (int i=0; i<size.height; i++)
+        {
+            cv::Vec3f* ray = rays.ptr<cv::Vec3f>(i);
+            const cv::Vec2f* p = normalized.ptr<cv::Vec2f>(i*size.width);
+            for (int j=0; j<size.width; j++)
+                ray[j] = cv::Vec3f(p[j][0], p[j][1], 1.f);
+        }
+    }
+
+    std::memcpy(m_rays.params, params, sizeof(params));
+    m_rays.size = size;
+    m_rays.rays = rays;
+    return m_rays.rays;
+}
+
+bool CameraCalibration::hasDistortion() const
+{
+    float params[9];
+    snapshot(params);
+    return isDistorted(params);
+}
+
+void CameraCalibration::undistortFrame(const cv::Mat& frame, cv::Mat& undistorted) const
+{
+    float params[9];
+    snapshot(params);
+    if (!isDistorted(params))
+    {
+        frame.copyTo(undistorted);
+        return;
+    }
+
+    if (m_undistort.map1.empty() || m_undistort.size != frame.size() ||
+        std::memcmp(params, m_undistort.params, sizeof(params)) != 0)
+    {
+        cv::Mat distortion(5, 1, CV_32F, params + 4), map1, map2;
+        cv::Mat K = cameraMatrix(params);
+        cv::initUndistortRectifyMap(K, distortion, cv::Mat(), K, frame.size(),
+                                    CV_16SC2, map1, map2);
+        std::memcpy(m_undistort.params, params, sizeof(params));
+        m_undistort.size = frame.size();
+        m_undistort.map1 = map1;
+        m_undistort.map2 = map2;
+    }
+
+    // remap cannot work in place
+    if (frame.data == undistorted.data)
+    {
+        cv::Mat source = frame.clone();
+        cv::remap(source, undistorted, m_undistort.map1, m_undistort.map2, cv::INTER_LINEAR);
+    }
+    else
+        cv::remap(frame, undistorted, m_undistort.map1, m_undistort.map2, cv::INTER_LINEAR);
+}
+
+static void poseMatrix(const Transformation& pose, float m[12])
+{
+    for (int i=0; i<3; i++)
+    {
+        for (int j=0; j<3; j++)
+            m[4*i+j] = pose.r()(i,j);
+        m[4*i+3] = pose.t()[i];
+    }
+}
+
+void CameraCalibration::project(const cv::Vec3f* points, cv::Vec2f* pixels, size_t count,
+                                const Transformation& pose) const
+{
+    float m[12], params[9];
+    poseMatrix(pose, m);
+    snapshot(params);
+    projectPoints(reinterpret_cast<const float*>(points), reinterpret_cast<float*>(pixels),
+                  count, m, params);
+}
+
+void CameraCalibration::project(const cv::Mat& points, const Transformation& pose, cv::Mat& pixels) const
+{
+    CV_Assert(points.type() == CV_32FC3);
+    CV_Assert(&points != &pixels);
+
+    float m[12], params[9];
+    poseMatrix(pose, m);
+    snapshot(params);
+    pixels.create(points.size(), CV_32FC2);
+
+    if (points.isContinuous() && pixels.isContinuous())
+    {
+        const size_t total = points.total();
+        const float* src = points.ptr<float>();
+        float* dst = pixels.ptr<float>();
+        parallelForRows(int((total + PROJECT_BLOCK - 1)/PROJECT_BLOCK), [&](int begin, int end){
+            size_t first = size_t(begin)*PROJECT_BLOCK;
+            size_t last = std::min(total, size_t(end)*PROJECT_BLOCK);
+            projectPoints(src + 3*first, dst + 2*first, last - first, m, params);
+        }, 1);
+    }
+    else
+    {
+        parallelForRows(points.rows, [&](int begin, int end){
+            for (int i=begin; i<end; i++)
+                projectPoints(points.ptr<float>(i), pixels.ptr<float>(i), points.cols, m, params);
+        });
+    }
+}
+
+void backprojectDepth(const cv::Mat& depth, const CameraCalibration& calibration,
+                      cv::Mat& xyz, float depthScale)
+{
+    CV_Assert(depth.type() == CV_16UC1 || depth.type() == CV_32FC1);
+    CV_Assert(depthScale > 0);
+
+    const cv::Mat& rays = calibration.getRays(depth.size());
+    const float scale = 1.f/depthScale;
+    xyz.create(depth.size(), CV_32FC3);
+    parallelForRows(depth.rows, [&](int begin, int end){
+        for (int i=begin; i<end; i++)
+        {
+            if (depth.type() == CV_16UC1)
+                backprojectDepth(depth.ptr<uint16_t>(i), rays.ptr<float>(i),
+                                 xyz.ptr<float>(i), depth.cols, scale);
+            else
+                backprojectDepth(depth.ptr<float>(i), rays.ptr<float>(i),
+                                 xyz.ptr<float>(i), depth.cols, scale);
+        }
+    });
+}
+
+bool estimateCalibration(const cv::Mat& map, CameraCalibration& calibration)
+{
+    CV_Assert(map.type() == CV_32FC3);
+
+    // x/z = (u - cx)/fx and y/z = (v - cy)/fy are linear in the pixel
+    // coordinates; fit both lines with coordinates centered on the image
+    // to keep the normal equations well conditioned.
+    double u0 = 0.5*map.cols, v0 = 0.5*map.rows;
+    double n = 0;
+    double su = 0, suu = 0, sa = 0, sua = 0;
+    double sv = 0, svv = 0, sb = 0, svb = 0;
+
+    for (int i=0; i<map.rows; i++)
+    {
+        const cv::Vec3f* row = map.ptr<cv::Vec3f>(i);
+        double v = i - v0;
+        for (int j=0; j<map.cols; j++)
+        {
+            const cv::Vec3f& p = row[j];
+            if (!(p[2] > 0.f))      // invalid (zero) or NaN depth
+                continue;
+
+            double u = j - u0;
+            double a = p[0]/p[2];
+            double b = p[1]/p[2];
+            n   += 1;
+            su  += u;  suu += u*u;  sa += a;  sua += u*a;
+            sv  += v;  svv += v*v;  sb += b;  svb += v*b;
+        }
+    }
+
+    if (n < 3)
+        return false;
+
+    double du = n*suu - su*su;
+    double dv = n*svv - sv*sv;
+    if (du <= 0 || dv <= 0)
+        return false;
+
+    double ax = (n*sua - su*sa)/du, bx = (sa - ax*su)/n;
+    double ay = (n*svb - sv*sb)/dv, by = (sb - ay*sv)/n;
+    if (ax == 0 || ay == 0)
+        return false;
+
+    calibration = CameraCalibration(float(1.0/ax), float(1.0/ay),
+                                     float(u0 - bx/ax), float(v0 - by/ay));
+    return true;
+}
+
 }//mcv
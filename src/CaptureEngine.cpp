@@ -0,0 +1,177 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "CaptureEngine.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace mcv {
+
+CaptureEngine::CaptureEngine( int device, size_t ringSize, bool grabColor )
+  : m_source(new OpenNIFrameSource(device))
+  , m_grabColor(grabColor)
+  , m_ring( std::max<size_t>( ringSize, 2 ) )
+  , m_head(0)
+  , m_count(0)
+  , m_running(false)
+  , m_latencySum(0){
+    m_stats = CaptureStats();
+}
+
+CaptureEngine::CaptureEngine( const cv::Ptr<FrameSource>& source, size_t ringSize, bool grabColor )
+  : m_source(source)
+  , m_grabColor(grabColor)
+  , m_ring( std::max<size_t>( ringSize, 2 ) )
+  , m_head(0)
+  , m_count(0)
+  , m_running(false)
+  , m_latencySum(0){
+    CV_Assert( !m_source.empty() );
+    m_stats = CaptureStats();
+}
+
+CaptureEngine::~CaptureEngine(){
+    stop();
+}
+
+bool CaptureEngine::start(){
+    if ( m_running )
+        return true;
+
+    if ( !m_source->isOpened() && !m_source->open() )
+        return false;
+
+    m_running = true;
+    m_thread = std::thread( &CaptureEngine::run, this );
+    return true;
+}
+
+void CaptureEngine::stop(){
+    m_running = false;
+    if ( m_thread.joinable() )
+        m_thread.join();
+    m_ready.notify_all();
+    m_source->close();
+}
+
+bool CaptureEngine::isRunning() const{
+    return m_running;
+}
+
+FrameSource& CaptureEngine::source(){
+    return *m_source;
+}
+
+void CaptureEngine::run(){
+    while ( m_running ){
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if ( m_count == m_ring.size() ){
+                // Ring full: the oldest unread frame is sacrificed
+                m_head = ( m_head + 1 ) % m_ring.size();
+                m_count--;
+                m_stats.dropped++;
+            }
+            // Outside [m_head, m_head+m_count), consumers never touch it
+            index = ( m_head + m_count ) % m_ring.size();
+        }
+
+        Slot& slot = m_ring[index];
+        if ( !slot.cloud.grabFrame( *m_source, m_grabColor, &slot.timestamp ) ){
+            m_running = false;
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_count++;
+            m_stats.captured++;
+        }
+        m_ready.notify_all();
+    }
+    m_ready.notify_all();
+}
+
+void CaptureEngine::deliver( size_t index, Point3Cloud& cloud, double* timestamp ){
+    // Called with m_mutex held
+    Slot& slot = m_ring[index];
+    cloud.swap( slot.cloud );
+    if ( timestamp )
+        *timestamp = slot.timestamp;
+
+    double latency = ( frameClock() - slot.timestamp )*1000.0;
+    m_latencySum += latency;
+    m_stats.delivered++;
+    m_stats.maxLatencyMs = std::max( m_stats.maxLatencyMs, latency );
+}
+
+bool CaptureEngine::latest( Point3Cloud& cloud, double* timestamp ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if ( m_count == 0 )
+        return false;
+
+    size_t newest = ( m_head + m_count - 1 ) % m_ring.size();
+    m_stats.dropped += m_count - 1;
+    m_head = ( newest + 1 ) % m_ring.size();
+    m_count = 0;
+    deliver( newest, cloud, timestamp );
+    return true;
+}
+
+bool CaptureEngine::next( Point3Cloud& cloud, int timeoutMs, double* timestamp ){
+    std::unique_lock<std::mutex> lock( m_mutex );
+    bool available;
+    if ( timeoutMs < 0 ){
+        m_ready.wait( lock, [this]{ return m_count > 0 || !m_running; } );
+        available = m_count > 0;
+    } else {
+        available = m_ready.wait_for( lock, std::chrono::milliseconds(timeoutMs),
+                                      [this]{ return m_count > 0 || !m_running; } ) && m_count > 0;
+    }
+    if ( !available )
+        return false;
+
+    size_t oldest = m_head;
+    m_head = ( m_head + 1 ) % m_ring.size();
+    m_count--;
+    deliver( oldest, cloud, timestamp );
+    return true;
+}
+
+CaptureStats CaptureEngine::stats() const{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    CaptureStats s = m_stats;
+    s.meanLatencyMs = s.delivered ? m_latencySum / s.delivered : 0.0;
+    return s;
+}
+
+} // mcv
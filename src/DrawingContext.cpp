@@ -5,21 +5,73 @@
 *****************************************************************************/
 
 #include "DrawingContext.hpp"
+#include "Profiler.hpp"
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <GL/glext.h>
+
+#include <cstring>
+#include <cstddef>
 
 namespace mcv {
 
+//! Vertex of the overlay buffers, the attribute being a normal or a colour
+struct OverlayVertex
+{
+    GLfloat position[3];
+    GLfloat attribute[3];
+};
+
+static void fillVertex(OverlayVertex& v, float x, float y, float z, float a0, float a1, float a2){
+    v.position[0] = x;   v.position[1] = y;   v.position[2] = z;
+    v.attribute[0] = a0; v.attribute[1] = a1; v.attribute[2] = a2;
+}
+
+//! Draws count vertices of an overlay buffer, the attribute bound as
+//! normals (GL_NORMAL_ARRAY) or colours (GL_COLOR_ARRAY)
+static void drawOverlayBuffer(GLuint buffer, GLenum mode, int count, GLenum attribute){
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(attribute);
+    glVertexPointer(3, GL_FLOAT, sizeof(OverlayVertex),
+                    reinterpret_cast<const GLvoid*>(offsetof(OverlayVertex, position)));
+    const GLvoid* offset = reinterpret_cast<const GLvoid*>(offsetof(OverlayVertex, attribute));
+    if (attribute == GL_NORMAL_ARRAY)
+        glNormalPointer(GL_FLOAT, sizeof(OverlayVertex), offset);
+    else
+        glColorPointer(3, GL_FLOAT, sizeof(OverlayVertex), offset);
+
+    glDrawArrays(mode, 0, count);
+
+    glDisableClientState(attribute);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+enum { CUBE_VERTEX_COUNT = 24,
+       AXIS_VERTEX_COUNT = 6 };
+
 void DrawingContextDrawCallback(void* param){
     DrawingContext * ctx = static_cast<DrawingContext*>(param);
     if (ctx)
         ctx->draw();
 }
 
-DrawingContext::DrawingContext(std::string windowName, cv::Size frameSize, const CameraCalibration& c)
+DrawingContext::DrawingContext(const CameraCalibration& c, OffscreenContext* offscreen, const std::string& windowName)
   : m_isTextureInitialized(false)
+  , m_textureChannels(0)
+  , m_pixelBufferId(0)
+  , m_isBackgroundUploaded(false)
+  , m_areOverlayBuffersInitialized(false)
+  , m_colorBarVertexCount(0)
   , m_calibration(c)
-  , m_windowName(windowName){
+  , m_windowName(windowName)
+  , m_offscreen(offscreen){
+}
+
+DrawingContext::DrawingContext(std::string windowName, cv::Size frameSize, const CameraCalibration& c)
+  : DrawingContext(c, 0, windowName){
     // Create window with OpenGL support
     cv::namedWindow(windowName, CV_WINDOW_OPENGL);
 
@@ -31,19 +83,62 @@ DrawingContext::DrawingContext(std::string windowName, cv::Size frameSize, const
     cv::setOpenGlDrawCallback(windowName, DrawingContextDrawCallback, this);
 }
 
+DrawingContext::DrawingContext(OffscreenContext& offscreen, const CameraCalibration& c)
+  : DrawingContext(c, &offscreen, std::string()){
+}
+
 DrawingContext::~DrawingContext(){
-    cv::setOpenGlDrawCallback(m_windowName, 0, 0);
+    if (m_isTextureInitialized){
+        makeCurrent();
+        glDeleteTextures(1, &m_backgroundTextureId);
+        glDeleteBuffers(1, &m_pixelBufferId);
+    }
+    if (m_areOverlayBuffersInitialized){
+        makeCurrent();
+        GLuint buffers[] = { m_cubeBufferId, m_axisBufferId, m_colorBarBufferId };
+        glDeleteBuffers(3, buffers);
+    }
+    if (!m_offscreen)
+        cv::setOpenGlDrawCallback(m_windowName, 0, 0);
+}
+
+void DrawingContext::makeCurrent(){
+    if (m_offscreen)
+        m_offscreen->makeCurrent();
+    else
+        cv::setOpenGlContext(m_windowName);
 }
 
 void DrawingContext::updateBackground(const cv::Mat& frame){
-    frame.copyTo(m_backgroundImage);
+    MCV_PROFILE_SCOPE("DrawingContext::updateBackground");
+    if (m_calibration.hasDistortion())
+        m_calibration.undistortFrame(frame, m_backgroundImage);
+    else
+        m_backgroundImage = frame;
+    m_isBackgroundUploaded = false;
 }
 
 void DrawingContext::updateWindow(){
-    cv::updateWindow(m_windowName);
+    if (m_offscreen){
+        m_offscreen->makeCurrent();
+        m_offscreen->beginFrame();
+        draw();
+        m_offscreen->endFrame();
+    }else{
+        cv::updateWindow(m_windowName);
+    }
+}
+
+bool DrawingContext::retrieveFrame(cv::Mat& image, bool wait){
+    if (!m_offscreen)
+        return false;
+    m_offscreen->makeCurrent();
+    return m_offscreen->retrieveFrame(image, wait);
 }
 
 void DrawingContext::draw(){
+    MCV_PROFILE_GPU_COLLECT(this);
+    MCV_PROFILE_SCOPE("DrawingContext::draw");
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT); // Clear entire screen:
     drawCameraFrame();                                  // Render background
     drawAugmentedScene();                               // Draw AR
@@ -51,7 +146,59 @@ void DrawingContext::draw(){
 }
 
 
+void DrawingContext::uploadBackground(){
+    int w = m_backgroundImage.cols;
+    int h = m_backgroundImage.rows;
+    int channels = m_backgroundImage.channels();
+    GLenum format;
+    switch (channels){
+        case 1:  format = GL_LUMINANCE; break;
+        case 3:  format = GL_BGR_EXT;   break;
+        case 4:  format = GL_BGRA_EXT;  break;
+        default: return;
+    }
+
+    // Texture storage only follows the frame size and format
+    glBindTexture(GL_TEXTURE_2D, m_backgroundTextureId);
+    if (m_textureSize != m_backgroundImage.size() || m_textureChannels != channels){
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, format, GL_UNSIGNED_BYTE, 0);
+        m_textureSize = m_backgroundImage.size();
+        m_textureChannels = channels;
+    }
+
+    // The texture is sampled later in this same frame, so the upload cannot
+    // overlap the drawing; a second buffer would only buy that with a frame
+    // of latency between the video and the AR overlay. Orphaning the buffer
+    // still keeps the map from waiting on the previous frame's transfer.
+    size_t rowBytes = size_t(w)*channels;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBufferId);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, rowBytes*h, 0, GL_STREAM_DRAW);
+    uchar* pixels = static_cast<uchar*>(glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY));
+    if (pixels){
+        if (m_backgroundImage.isContinuous())
+            std::memcpy(pixels, m_backgroundImage.data, rowBytes*h);
+        else
+            for (int i=0; i<h; i++)
+                std::memcpy(pixels + i*rowBytes, m_backgroundImage.ptr(i), rowBytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        // Sourced from the bound buffer, the driver schedules the copy
+        // itself; the background draw below waits for it
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, GL_UNSIGNED_BYTE, 0);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // The frame is in GL memory: a referenced caller image is let go, an
+    // undistorted one is kept as the destination of the next remap
+    if (!m_calibration.hasDistortion())
+        m_backgroundImage.release();
+    m_isBackgroundUploaded = true;
+}
+
 void DrawingContext::drawCameraFrame(){
+    MCV_PROFILE_SCOPE("DrawingContext::drawCameraFrame");
+    MCV_PROFILE_GPU_SCOPE("DrawingContext::drawCameraFrame", this);
     // Initialize texture for background image
     if (!m_isTextureInitialized){
         glGenTextures(1, &m_backgroundTextureId);
@@ -60,22 +207,16 @@ void DrawingContext::drawCameraFrame(){
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+        glGenBuffers(1, &m_pixelBufferId);
+
         m_isTextureInitialized = true;
     }
 
-    int w = m_backgroundImage.cols;
-    int h = m_backgroundImage.rows;
-
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glBindTexture(GL_TEXTURE_2D, m_backgroundTextureId);
+    if (!m_isBackgroundUploaded && !m_backgroundImage.empty())
+        uploadBackground();
 
-    // Upload new texture data:
-    if (m_backgroundImage.channels() == 3)
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_BGR_EXT, GL_UNSIGNED_BYTE, m_backgroundImage.data);
-    else if(m_backgroundImage.channels() == 4)
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_BGRA_EXT, GL_UNSIGNED_BYTE, m_backgroundImage.data);
-    else if (m_backgroundImage.channels()==1)
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, m_backgroundImage.data);
+    int w = m_textureSize.width;
+    int h = m_textureSize.height;
 
     const GLfloat bgTextureVertices[] = { 0, 0, w, 0, 0, h, w, h };
     const GLfloat bgTextureCoords[]   = { 1, 0, 1, 1, 0, 0, 0, 1 };
@@ -106,20 +247,27 @@ void DrawingContext::drawCameraFrame(){
 }
 
 void DrawingContext::drawAugmentedScene(){
-    // Init augmentation projection
-    Matx44f projectionMatrix;
-    int w = m_backgroundImage.cols;
-    int h = m_backgroundImage.rows;
-    buildProjectionMatrix(m_calibration, w, h, projectionMatrix);
-    projectionMatrix = projectionMatrix.t(); // Transpose the matrix because OpenCV is row-major and OpenGL is column-major
-    glMatrixMode(GL_PROJECTION);
-    glLoadMatrixf(projectionMatrix.val);
+    MCV_PROFILE_SCOPE("DrawingContext::drawAugmentedScene");
+    MCV_PROFILE_GPU_SCOPE("DrawingContext::drawAugmentedScene", this);
+    if (!m_areOverlayBuffersInitialized)
+        initOverlayBuffers();
+    updateProjections();
 
+    // Colour bar in pixel coordinates
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(m_colorBarProjection.val);
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
     drawColorBar(15,100,10,20);
 
+    // Init augmentation projection
+    glMatrixMode(GL_PROJECTION);
+    glLoadMatrixf(m_projectionMatrix.val);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+
     if (isPatternPresent)
     {
     // Set the pattern transformation
@@ -134,6 +282,71 @@ void DrawingContext::drawAugmentedScene(){
     }
 }
 
+void DrawingContext::updateProjections(){
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    cv::Vec4i currentViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    cv::Vec4f intrinsics(m_calibration.fx(), m_calibration.fy(), m_calibration.cx(), m_calibration.cy());
+
+    if (intrinsics != m_projectionIntrinsics || m_textureSize != m_projectionSize){
+        buildProjectionMatrix(m_calibration, m_textureSize.width, m_textureSize.height, m_projectionMatrix);
+        m_projectionMatrix = m_projectionMatrix.t(); // Transpose the matrix because OpenCV is row-major and OpenGL is column-major
+        m_projectionIntrinsics = intrinsics;
+        m_projectionSize = m_textureSize;
+    }
+
+    if (currentViewport != m_projectionViewport){
+        // gluOrtho2D(0, width, 0, height), column-major
+        m_colorBarProjection = Matx44f::zeros();
+        m_colorBarProjection(0,0) = 2.0f / viewport[2];
+        m_colorBarProjection(1,1) = 2.0f / viewport[3];
+        m_colorBarProjection(2,2) = -1.0f;
+        m_colorBarProjection(3,0) = -1.0f;
+        m_colorBarProjection(3,1) = -1.0f;
+        m_colorBarProjection(3,3) = 1.0f;
+        m_projectionViewport = currentViewport;
+    }
+}
+
+void DrawingContext::initOverlayBuffers(){
+    GLuint buffers[3];
+    glGenBuffers(3, buffers);
+    m_cubeBufferId     = buffers[0];
+    m_axisBufferId     = buffers[1];
+    m_colorBarBufferId = buffers[2];
+
+    // Cube faces as quads, each with its normal
+    static const float faces[6][3] = { {0,0,1}, {0,0,-1}, {0,1,0}, {0,-1,0}, {1,0,0}, {-1,0,0} };
+    static const float corners[6][4][3] = {
+        { {-1,-1, 1}, { 1,-1, 1}, { 1, 1, 1}, {-1, 1, 1} },   // Front
+        { {-1,-1,-1}, {-1, 1,-1}, { 1, 1,-1}, { 1,-1,-1} },   // Back
+        { {-1, 1,-1}, {-1, 1, 1}, { 1, 1, 1}, { 1, 1,-1} },   // Top
+        { {-1,-1,-1}, { 1,-1,-1}, { 1,-1, 1}, {-1,-1, 1} },   // Bottom
+        { { 1,-1,-1}, { 1, 1,-1}, { 1, 1, 1}, { 1,-1, 1} },   // Right
+        { {-1,-1,-1}, {-1,-1, 1}, {-1, 1, 1}, {-1, 1,-1} } }; // Left
+    OverlayVertex cube[CUBE_VERTEX_COUNT];
+    for (int f=0; f<6; f++)
+        for (int k=0; k<4; k++)
+            fillVertex(cube[4*f+k], corners[f][k][0], corners[f][k][1], corners[f][k][2],
+                       faces[f][0], faces[f][1], faces[f][2]);
+    glBindBuffer(GL_ARRAY_BUFFER, m_cubeBufferId);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(cube), cube, GL_STATIC_DRAW);
+
+    // One unit line per axis, red X, green Y, blue Z
+    OverlayVertex axes[AXIS_VERTEX_COUNT];
+    for (int a=0; a<3; a++){
+        float end[3] = { 0, 0, 0 };
+        end[a] = 1;
+        fillVertex(axes[2*a],   0, 0, 0, end[0], end[1], end[2]);
+        fillVertex(axes[2*a+1], end[0], end[1], end[2], end[0], end[1], end[2]);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, m_axisBufferId);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(axes), axes, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_areOverlayBuffersInitialized = true;
+}
+
 void DrawingContext::buildProjectionMatrix(const CameraCalibration& calibration, int screen_width, int screen_height, Matx44f& projectionMatrix){
     float nearPlane = 0.01f;  // Near clipping distance
     float farPlane  = 100.0f;  // Far clipping distance
@@ -167,27 +380,8 @@ void DrawingContext::buildProjectionMatrix(const CameraCalibration& calibration,
 
 
 void DrawingContext::drawCoordinateAxis(){
-    static float lineX[] = {0,0,0,1,0,0};
-    static float lineY[] = {0,0,0,0,1,0};
-    static float lineZ[] = {0,0,0,0,0,1};
-
     glLineWidth(2);
-
-    glBegin(GL_LINES);
-
-    glColor3f(1.0f, 0.0f, 0.0f);
-    glVertex3fv(lineX);
-    glVertex3fv(lineX + 3);
-
-    glColor3f(0.0f, 1.0f, 0.0f);
-    glVertex3fv(lineY);
-    glVertex3fv(lineY + 3);
-
-    glColor3f(0.0f, 0.0f, 1.0f);
-    glVertex3fv(lineZ);
-    glVertex3fv(lineZ + 3);
-
-    glEnd();
+    drawOverlayBuffer(m_axisBufferId, GL_LINES, AXIS_VERTEX_COUNT, GL_COLOR_ARRAY);
 }
 
 void DrawingContext::drawCubeModel(){
@@ -215,183 +409,56 @@ void DrawingContext::drawCubeModel(){
     glTranslatef(0,0, 1);
 
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    glBegin(GL_QUADS);
-    // Front Face
-    glNormal3f( 0.0f, 0.0f, 1.0f);    // Normal Pointing Towards Viewer
-    glVertex3f(-1.0f, -1.0f,  1.0f);  // Point 1 (Front)
-    glVertex3f( 1.0f, -1.0f,  1.0f);  // Point 2 (Front)
-    glVertex3f( 1.0f,  1.0f,  1.0f);  // Point 3 (Front)
-    glVertex3f(-1.0f,  1.0f,  1.0f);  // Point 4 (Front)
-    // Back Face
-    glNormal3f( 0.0f, 0.0f,-1.0f);    // Normal Pointing Away From Viewer
-    glVertex3f(-1.0f, -1.0f, -1.0f);  // Point 1 (Back)
-    glVertex3f(-1.0f,  1.0f, -1.0f);  // Point 2 (Back)
-    glVertex3f( 1.0f,  1.0f, -1.0f);  // Point 3 (Back)
-    glVertex3f( 1.0f, -1.0f, -1.0f);  // Point 4 (Back)
-    // Top Face
-    glNormal3f( 0.0f, 1.0f, 0.0f);    // Normal Pointing Up
-    glVertex3f(-1.0f,  1.0f, -1.0f);  // Point 1 (Top)
-    glVertex3f(-1.0f,  1.0f,  1.0f);  // Point 2 (Top)
-    glVertex3f( 1.0f,  1.0f,  1.0f);  // Point 3 (Top)
-    glVertex3f( 1.0f,  1.0f, -1.0f);  // Point 4 (Top)
-    // Bottom Face
-    glNormal3f( 0.0f,-1.0f, 0.0f);    // Normal Pointing Down
-    glVertex3f(-1.0f, -1.0f, -1.0f);  // Point 1 (Bottom)
-    glVertex3f( 1.0f, -1.0f, -1.0f);  // Point 2 (Bottom)
-    glVertex3f( 1.0f, -1.0f,  1.0f);  // Point 3 (Bottom)
-    glVertex3f(-1.0f, -1.0f,  1.0f);  // Point 4 (Bottom)
-    // Right face
-    glNormal3f( 1.0f, 0.0f, 0.0f);    // Normal Pointing Right
-    glVertex3f( 1.0f, -1.0f, -1.0f);  // Point 1 (Right)
-    glVertex3f( 1.0f,  1.0f, -1.0f);  // Point 2 (Right)
-    glVertex3f( 1.0f,  1.0f,  1.0f);  // Point 3 (Right)
-    glVertex3f( 1.0f, -1.0f,  1.0f);  // Point 4 (Right)
-    // Left Face
-    glNormal3f(-1.0f, 0.0f, 0.0f);    // Normal Pointing Left
-    glVertex3f(-1.0f, -1.0f, -1.0f);  // Point 1 (Left)
-    glVertex3f(-1.0f, -1.0f,  1.0f);  // Point 2 (Left)
-    glVertex3f(-1.0f,  1.0f,  1.0f);  // Point 3 (Left)
-    glVertex3f(-1.0f,  1.0f, -1.0f);  // Point 4 (Left)
-    glEnd();
+    drawOverlayBuffer(m_cubeBufferId, GL_QUADS, CUBE_VERTEX_COUNT, GL_NORMAL_ARRAY);
 
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     glColor4f(0.2f,0.65f,0.3f,0.35f); // Full Brightness, 50% Alpha ( NEW )
-    glBegin(GL_QUADS);
-    // Front Face
-    glNormal3f( 0.0f, 0.0f, 1.0f);    // Normal Pointing Towards Viewer
-    glVertex3f(-1.0f, -1.0f,  1.0f);  // Point 1 (Front)
-    glVertex3f( 1.0f, -1.0f,  1.0f);  // Point 2 (Front)
-    glVertex3f( 1.0f,  1.0f,  1.0f);  // Point 3 (Front)
-    glVertex3f(-1.0f,  1.0f,  1.0f);  // Point 4 (Front)
-    // Back Face
-    glNormal3f( 0.0f, 0.0f,-1.0f);    // Normal Pointing Away From Viewer
-    glVertex3f(-1.0f, -1.0f, -1.0f);  // Point 1 (Back)
-    glVertex3f(-1.0f,  1.0f, -1.0f);  // Point 2 (Back)
-    glVertex3f( 1.0f,  1.0f, -1.0f);  // Point 3 (Back)
-    glVertex3f( 1.0f, -1.0f, -1.0f);  // Point 4 (Back)
-    // Top Face
-    glNormal3f( 0.0f, 1.0f, 0.0f);    // Normal Pointing Up
-    glVertex3f(-1.0f,  1.0f, -1.0f);  // Point 1 (Top)
-    glVertex3f(-1.0f,  1.0f,  1.0f);  // Point 2 (Top)
-    glVertex3f( 1.0f,  1.0f,  1.0f);  // Point 3 (Top)
-    glVertex3f( 1.0f,  1.0f, -1.0f);  // Point 4 (Top)
-    // Bottom Face
-    glNormal3f( 0.0f,-1.0f, 0.0f);    // Normal Pointing Down
-    glVertex3f(-1.0f, -1.0f, -1.0f);  // Point 1 (Bottom)
-    glVertex3f( 1.0f, -1.0f, -1.0f);  // Point 2 (Bottom)
-    glVertex3f( 1.0f, -1.0f,  1.0f);  // Point 3 (Bottom)
-    glVertex3f(-1.0f, -1.0f,  1.0f);  // Point 4 (Bottom)
-    // Right face
-    glNormal3f( 1.0f, 0.0f, 0.0f);    // Normal Pointing Right
-    glVertex3f( 1.0f, -1.0f, -1.0f);  // Point 1 (Right)
-    glVertex3f( 1.0f,  1.0f, -1.0f);  // Point 2 (Right)
-    glVertex3f( 1.0f,  1.0f,  1.0f);  // Point 3 (Right)
-    glVertex3f( 1.0f, -1.0f,  1.0f);  // Point 4 (Right)
-    // Left Face
-    glNormal3f(-1.0f, 0.0f, 0.0f);    // Normal Pointing Left
-    glVertex3f(-1.0f, -1.0f, -1.0f);  // Point 1 (Left)
-    glVertex3f(-1.0f, -1.0f,  1.0f);  // Point 2 (Left)
-    glVertex3f(-1.0f,  1.0f,  1.0f);  // Point 3 (Left)
-    glVertex3f(-1.0f,  1.0f, -1.0f);  // Point 4 (Left)
-    glEnd();
+    drawOverlayBuffer(m_cubeBufferId, GL_QUADS, CUBE_VERTEX_COUNT, GL_NORMAL_ARRAY);
 
     glPopAttrib();
 }
 
 void DrawingContext::drawColorBar(int size_x, int size_y,int x_init,int y_init){
-    std::vector<cv::Vec3f> colorSteps;
-    cv::Vec3f COL_BLUE(0,0,1);
-    cv::Vec3f COL_CYAN(0,1,1);
-    cv::Vec3f COL_GREEN(0,1,0);
-    cv::Vec3f COL_YELLOW(1,1,0);
-    cv::Vec3f COL_RED(1,0,0);
-
-    colorSteps.push_back(COL_BLUE);
-    colorSteps.push_back(COL_CYAN);
-    colorSteps.push_back(COL_GREEN);
-    colorSteps.push_back(COL_YELLOW);
-    colorSteps.push_back(COL_RED);
-
-    // store draw mode (light and polygon mode)
-    GLint polygon_draw_mode[2];
-    glGetIntegerv(GL_POLYGON_MODE,polygon_draw_mode);
-
-    std::vector<cv::Vec3f>::iterator it(colorSteps.begin());
-    cv::Vec3d current,prev;
-
-    GLint viewport[4];
-    glGetIntegerv(GL_VIEWPORT,viewport);
-
-    glDisable ( GL_LIGHTING );
-    glPolygonMode(GL_FRONT,GL_FILL);
-
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-        glLoadIdentity();
-        gluOrtho2D(0, viewport[2], 0, viewport[3]);
-        glMatrixMode(GL_MODELVIEW);
-        glPushMatrix();
-        glLoadIdentity();
-
-        glTranslatef(x_init, y_init,0);
-        //double coef_x(size_x);
-        double coef_y(size_y/double(colorSteps.size()-1) );
-
-        for(unsigned int i=0;i<colorSteps.size()-1;i++){
-            prev=*it;
-            it++;
-            current=*it;
-
-            glBegin(GL_QUADS);
-
-            glNormal3d(0,0,1.0);
-            glColor3d(prev[0], prev[1], prev[2]);
-            glVertex3d(size_x,(i)*coef_y,0);
-
-            glNormal3d(0,0,1.0);
-            glColor3d(current[0],current[1],current[2]);
-            glVertex3d(size_x,(i+1)*coef_y,0);
-
-            glNormal3d(0,0,1.0);
-            glColor3d(current[0],current[1],current[2]);
-            glVertex3d(0,(i+1)*coef_y,0);
-
-            glNormal3d(0,0,1.0);
-            glColor3d(prev[0], prev[1], prev[2]);
-            glVertex3d(0,(i)*coef_y,0);
-
-            glEnd();
-
-            double t0=(double)(i)/((double)colorSteps.size()-1);
-            double t1=(double)(i+1)/((double)colorSteps.size()-1);
-
-            glBegin(GL_QUADS);
-
-            glNormal3d(0,0,1.0);
-            glColor3d(t0,t0,t0);
-            glVertex3d(2*size_x+10,i*coef_y,0);
-
-            glNormal3d(0,0,1.0);
-            glColor3d(t1,t1,t1);
-            glVertex3d(2*size_x+10,(i+1)*coef_y,0);
-
-            glNormal3d(0,0,1.0);
-            glColor3d(t1,t1,t1);
-            glVertex3d(size_x+10,(i+1)*coef_y,0);
-
-            glNormal3d(0,0,1.0);
-            glColor3d(t0,t0,t0);
-            glVertex3d(size_x+10,i*coef_y,0);
-
-            glEnd();
+    // Baked in pixel coordinates, rebuilt only if the layout changes
+    cv::Vec4i layout(size_x, size_y, x_init, y_init);
+    if (m_colorBarVertexCount == 0 || layout != m_colorBarLayout){
+        static const float colorSteps[][3] = { {0,0,1}, {0,1,1}, {0,1,0}, {1,1,0}, {1,0,0} };
+        const int segments = sizeof(colorSteps)/sizeof(colorSteps[0]) - 1;
+        float coef_y = size_y/float(segments);
+
+        std::vector<OverlayVertex> bar(8*segments);
+        OverlayVertex* v = &bar[0];
+        for (int i=0; i<segments; i++){
+            const float* prev = colorSteps[i];
+            const float* current = colorSteps[i+1];
+            float y0 = y_init + i*coef_y, y1 = y_init + (i+1)*coef_y;
+
+            // Colour ramp
+            fillVertex(*v++, x_init + size_x, y0, 0, prev[0], prev[1], prev[2]);
+            fillVertex(*v++, x_init + size_x, y1, 0, current[0], current[1], current[2]);
+            fillVertex(*v++, x_init,          y1, 0, current[0], current[1], current[2]);
+            fillVertex(*v++, x_init,          y0, 0, prev[0], prev[1], prev[2]);
+
+            // Matching grey ramp
+            float t0 = float(i)/segments, t1 = float(i+1)/segments;
+            fillVertex(*v++, x_init + 2*size_x + 10, y0, 0, t0, t0, t0);
+            fillVertex(*v++, x_init + 2*size_x + 10, y1, 0, t1, t1, t1);
+            fillVertex(*v++, x_init + size_x + 10,   y1, 0, t1, t1, t1);
+            fillVertex(*v++, x_init + size_x + 10,   y0, 0, t0, t0, t0);
         }
+        glBindBuffer(GL_ARRAY_BUFFER, m_colorBarBufferId);
+        glBufferData(GL_ARRAY_BUFFER, bar.size()*sizeof(OverlayVertex), &bar[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        m_colorBarVertexCount = int(bar.size());
+        m_colorBarLayout = layout;
+    }
 
-        glPopMatrix();
-        glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-
-    //old polygon drawing mode restoration
-    glPolygonMode(GL_FRONT,polygon_draw_mode[0]|polygon_draw_mode[1]);
+    // Restores lighting and the polygon mode on the server side, no query
+    glPushAttrib(GL_ENABLE_BIT | GL_POLYGON_BIT);
+    glDisable(GL_LIGHTING);
+    glPolygonMode(GL_FRONT, GL_FILL);
+    glNormal3f(0, 0, 1);
+    drawOverlayBuffer(m_colorBarBufferId, GL_QUADS, m_colorBarVertexCount, GL_COLOR_ARRAY);
+    glPopAttrib();
 }
 }//mcv
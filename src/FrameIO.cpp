@@ -0,0 +1,440 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "FrameIO.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MCV_HAVE_MMAP 1
+#endif
+
+namespace mcv {
+
+const char* const FRAME_BINARY_EXTENSION     = ".mcvf";
+const char* const FRAME_COMPRESSED_EXTENSION = ".mcvz";
+
+static const char FRAME_MAGIC[4] = { 'M', 'C', 'V', 'F' };
+
+static size_t alignUp( size_t value, size_t alignment ){
+    return ( value + alignment - 1 ) / alignment * alignment;
+}
+
+static size_t planeBytes( const cv::Mat& plane ){
+    return plane.empty() ? 0 : plane.total()*plane.elemSize();
+}
+
+static void copyPlane( const cv::Mat& plane, uchar* dst ){
+    if ( plane.isContinuous() ){
+        std::memcpy( dst, plane.data, planeBytes(plane) );
+        return;
+    }
+    size_t rowBytes = plane.cols*plane.elemSize();
+    for( int i=0; i<plane.rows; i++ )
+        std::memcpy( dst + i*rowBytes, plane.ptr(i), rowBytes );
+}
+
+/*! MappedFile */
+MappedFile::MappedFile( const std::string& name )
+  : m_data(0)
+  , m_size(0)
+  , m_mapped(false){
+#ifdef MCV_HAVE_MMAP
+    int fd = ::open( name.c_str(), O_RDONLY );
+    if ( fd < 0 )
+        CV_Error( CV_StsError, "Cannot open frame file " + name );
+
+    struct stat st;
+    if ( ::fstat( fd, &st ) != 0 || st.st_size <= 0 ){
+        ::close( fd );
+        CV_Error( CV_StsError, "Cannot stat frame file " + name );
+    }
+    m_size = static_cast<size_t>( st.st_size );
+
+    void* p = ::mmap( 0, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+    if ( p == MAP_FAILED )
+        CV_Error( CV_StsError, "Cannot map frame file " + name );
+
+    m_data = static_cast<uchar*>( p );
+    m_mapped = true;
+#else
+    FILE* f = std::fopen( name.c_str(), "rb" );
+    if ( !f )
+        CV_Error( CV_StsError, "Cannot open frame file " + name );
+
+    std::fseek( f, 0, SEEK_END );
+    long length = std::ftell( f );
+    std::fseek( f, 0, SEEK_SET );
+    if ( length <= 0 ){
+        std::fclose( f );
+        CV_Error( CV_StsError, "Cannot read frame file " + name );
+    }
+    m_size = static_cast<size_t>( length );
+    m_data = new uchar[m_size];
+    size_t got = std::fread( m_data, 1, m_size, f );
+    std::fclose( f );
+    if ( got != m_size ){
+        delete [] m_data;
+        CV_Error( CV_StsError, "Cannot read frame file " + name );
+    }
+#endif
+}
+
+MappedFile::~MappedFile(){
+#ifdef MCV_HAVE_MMAP
+    if ( m_mapped )
+        ::munmap( m_data, m_size );
+#else
+    delete [] m_data;
+#endif
+}
+
+uchar* MappedFile::data() const{
+    return m_data;
+}
+
+size_t MappedFile::size() const{
+    return m_size;
+}
+
+/*! Helpers */
+std::string fileExtension( const std::string& name ){
+    size_t dot = name.find_last_of( '.' );
+    size_t slash = name.find_last_of( "/\\" );
+    if ( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) )
+        return std::string();
+
+    std::string ext = name.substr( dot );
+    std::transform( ext.begin(), ext.end(), ext.begin(), ::tolower );
+    return ext;
+}
+
+/*! Feeds whole little-endian 32 bit words to the Fletcher-64 sums. The
+ *  modulo is deferred to the end of each block; 65536 words cannot
+ *  overflow the sums. */
+static void fletcherWords( const uchar* p, size_t words, uint64_t& sum1, uint64_t& sum2 ){
+    const uint64_t MOD = 0xffffffffULL;
+    while ( words > 0 ){
+        size_t block = std::min<size_t>( words, 65536 );
+        words -= block;
+        for( size_t i=0; i<block; i++, p+=4 ){
+            uint32_t w;
+            std::memcpy( &w, p, 4 );
+            sum1 += w;
+            sum2 += sum1;
+        }
+        sum1 %= MOD;
+        sum2 %= MOD;
+    }
+}
+
+/*! Feeds the last 0-3 bytes, zero padded, and packs the sums */
+static uint64_t fletcherFinish( const uchar* p, size_t tail, uint64_t sum1, uint64_t sum2 ){
+    const uint64_t MOD = 0xffffffffULL;
+    if ( tail ){
+        uint32_t w = 0;
+        std::memcpy( &w, p, tail );
+        sum1 = ( sum1 + w ) % MOD;
+        sum2 = ( sum2 + sum1 ) % MOD;
+    }
+    return ( sum2 << 32 ) | sum1;
+}
+
+uint64_t frameChecksum( const uchar* buffer, size_t size ){
+    uint64_t sum1 = 0, sum2 = 0;
+    fletcherWords( buffer, size/4, sum1, sum2 );
+    return fletcherFinish( buffer + size/4*4, size%4, sum1, sum2 );
+}
+
+/*! Checksum of a whole frame of the given format version. Version 1 only
+ *  covers the planes; later versions cover the header too, read with its
+ *  checksum field zeroed. */
+static uint64_t frameBlobChecksum( const uchar* blob, size_t total, uint32_t version ){
+    if ( version < 2 )
+        return frameChecksum( blob + FRAME_HEADER_SIZE, total - FRAME_HEADER_SIZE );
+
+    uchar head[FRAME_HEADER_SIZE];
+    std::memcpy( head, blob, FRAME_HEADER_SIZE );
+    std::memset( head + offsetof(FrameHeader, checksum), 0, sizeof(uint64_t) );
+
+    uint64_t sum1 = 0, sum2 = 0;
+    fletcherWords( head, FRAME_HEADER_SIZE/4, sum1, sum2 );
+    const uchar* planes = blob + FRAME_HEADER_SIZE;
+    size_t bytes = total - FRAME_HEADER_SIZE;
+    fletcherWords( planes, bytes/4, sum1, sum2 );
+    return fletcherFinish( planes + bytes/4*4, bytes%4, sum1, sum2 );
+}
+
+/*! Encoding */
+static void initHeader( FrameHeader& header, FrameEncoding encoding,
+                        const cv::Mat& data, const cv::Mat& bgr ){
+    std::memset( &header, 0, sizeof(header) );
+    std::memcpy( header.magic, FRAME_MAGIC, 4 );
+    header.version    = FRAME_FORMAT_VERSION;
+    header.headerSize = FRAME_HEADER_SIZE;
+    header.encoding   = encoding;
+    header.rows       = data.rows;
+    header.cols       = data.cols;
+    header.dataType   = data.type();
+    header.bgrType    = bgr.empty() ? -1 : bgr.type();
+    header.dataOffset = FRAME_HEADER_SIZE;
+}
+
+/*! Lays the planes out once their sizes are known, returns the frame size */
+static size_t layoutPlanes( FrameHeader& header, size_t dataBytes, size_t bgrBytes ){
+    header.dataBytes = dataBytes;
+    header.bgrOffset = alignUp( header.dataOffset + header.dataBytes, FRAME_PLANE_ALIGN );
+    header.bgrBytes  = bgrBytes;
+    return alignUp( header.bgrOffset + header.bgrBytes, FRAME_PLANE_ALIGN );
+}
+
+static void sealFrame( FrameHeader& header, std::vector<uchar>& blob ){
+    header.checksum = 0;
+    std::memcpy( &blob[0], &header, sizeof(header) );
+    header.checksum = frameBlobChecksum( &blob[0], blob.size(), header.version );
+    std::memcpy( &blob[0], &header, sizeof(header) );
+}
+
+/*! Per column/row factors turning a depth into X and Y */
+static void projectionFactors( const float intrinsics[4], int rows, int cols,
+                               std::vector<float>& kx, std::vector<float>& ky ){
+    kx.resize( cols );
+    ky.resize( rows );
+    for( int j=0; j<cols; j++ )
+        kx[j] = ( j - intrinsics[2] ) / intrinsics[0];
+    for( int i=0; i<rows; i++ )
+        ky[i] = ( i - intrinsics[3] ) / intrinsics[1];
+}
+
+static void rebuildPoints( const cv::Mat& depth, const float intrinsics[4],
+                           float depthScale, cv::Mat& xyz ){
+    // The rays only live for this frame, next to the PNG decode they are cheap
+    CameraCalibration calibration( intrinsics[0], intrinsics[1], intrinsics[2], intrinsics[3] );
+    backprojectDepth( depth, calibration, xyz, depthScale );
+}
+
+/*! Quantizes the depth of a projective map, false if a rebuilt coordinate
+ *  would be off by more than one depth quantum */
+static bool quantizeDepth( const cv::Mat& data, const float intrinsics[4], cv::Mat& depth ){
+    std::vector<float> kx, ky;
+    projectionFactors( intrinsics, data.rows, data.cols, kx, ky );
+
+    // Every rebuilt coordinate must stay within one depth quantum
+    const float tolerance = 1.f/FRAME_DEPTH_SCALE;
+    depth.create( data.rows, data.cols, CV_16UC1 );
+    for( int i=0; i<data.rows; i++ ){
+        const cv::Vec3f* p = data.ptr<cv::Vec3f>(i);
+        ushort* d = depth.ptr<ushort>(i);
+        for( int j=0; j<data.cols; j++ ){
+            if ( p[j][0] == 0.f && p[j][1] == 0.f && p[j][2] == 0.f ){
+                d[j] = 0;                   // invalid pixel (OpenNI)
+                continue;
+            }
+            // NaN points and points behind the camera have no 16 bit depth,
+            // the frame is stored raw instead
+            if ( !( p[j][2] > 0.f ) )
+                return false;
+            float q = p[j][2]*FRAME_DEPTH_SCALE;
+            if ( q < 0.5f || q >= 65535.5f )
+                return false;
+            d[j] = static_cast<ushort>( cvRound(q) );
+
+            float z = d[j]/FRAME_DEPTH_SCALE;
+            if ( !( std::fabs( z - p[j][2] ) <= tolerance &&
+                    std::fabs( kx[j]*z - p[j][0] ) <= tolerance &&
+                    std::fabs( ky[i]*z - p[j][1] ) <= tolerance ) )
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool encodeDepth16( const cv::Mat& data, const cv::Mat& bgr,
+                           std::vector<uchar>& blob ){
+    if ( data.type() != CV_32FC3 || ( !bgr.empty() && bgr.depth() != CV_8U ) )
+        return false;
+
+    CameraCalibration calibration;
+    if ( !estimateCalibration( data, calibration ) )
+        return false;
+
+    float intrinsics[4] = { calibration.fx(), calibration.fy(),
+                            calibration.cx(), calibration.cy() };
+    cv::Mat depth;
+    if ( !quantizeDepth( data, intrinsics, depth ) )
+        return false;
+
+    // Fastest deflate level: the PNG filters already remove most redundancy
+    std::vector<int> params;
+    params.push_back( cv::IMWRITE_PNG_COMPRESSION );
+    params.push_back( 1 );
+
+    std::vector<uchar> depthPng, bgrPng;
+    if ( !cv::imencode( ".png", depth, depthPng, params ) )
+        return false;
+    if ( !bgr.empty() && !cv::imencode( ".png", bgr, bgrPng, params ) )
+        return false;
+
+    FrameHeader header;
+    initHeader( header, FRAME_ENCODING_DEPTH16, data, bgr );
+    std::memcpy( header.intrinsics, intrinsics, sizeof(intrinsics) );
+    header.depthScale = FRAME_DEPTH_SCALE;
+
+    blob.assign( layoutPlanes( header, depthPng.size(), bgrPng.size() ), 0 );
+    std::memcpy( &blob[header.dataOffset], &depthPng[0], depthPng.size() );
+    if ( !bgrPng.empty() )
+        std::memcpy( &blob[header.bgrOffset], &bgrPng[0], bgrPng.size() );
+    sealFrame( header, blob );
+    return true;
+}
+
+FrameEncoding encodeFrame( const cv::Mat& data, const cv::Mat& bgr,
+                           std::vector<uchar>& blob, FrameEncoding encoding ){
+    CV_Assert( !data.empty() && data.type() == CV_32FC3 );
+    CV_Assert( bgr.empty() || ( bgr.rows == data.rows && bgr.cols == data.cols ) );
+
+    if ( encoding == FRAME_ENCODING_DEPTH16 && encodeDepth16( data, bgr, blob ) )
+        return FRAME_ENCODING_DEPTH16;
+
+    FrameHeader header;
+    initHeader( header, FRAME_ENCODING_RAW, data, bgr );
+    blob.assign( layoutPlanes( header, planeBytes(data), planeBytes(bgr) ), 0 );
+
+    copyPlane( data, &blob[header.dataOffset] );
+    if ( header.bgrBytes )
+        copyPlane( bgr, &blob[header.bgrOffset] );
+    sealFrame( header, blob );
+    return FRAME_ENCODING_RAW;
+}
+
+static cv::Mat decodePng( uchar* buffer, uint64_t bytes ){
+    return cv::imdecode( cv::Mat( 1, static_cast<int>(bytes), CV_8UC1, buffer ),
+                         cv::IMREAD_UNCHANGED );
+}
+
+size_t decodeFrame( uchar* blob, size_t size,
+                    cv::Mat& data, cv::Mat& bgr, bool verify ){
+    if ( size < sizeof(FrameHeader) )
+        CV_Error( CV_StsParseError, "Frame is smaller than its header" );
+
+    FrameHeader header;
+    std::memcpy( &header, blob, sizeof(header) );
+    if ( std::memcmp( header.magic, FRAME_MAGIC, 4 ) != 0 )
+        CV_Error( CV_StsParseError, "Not a binary point cloud frame" );
+    if ( header.version == 0 || header.version > FRAME_FORMAT_VERSION ||
+         header.headerSize != FRAME_HEADER_SIZE )
+        CV_Error( CV_StsParseError, "Unsupported frame format version" );
+    if ( header.encoding != FRAME_ENCODING_RAW && header.encoding != FRAME_ENCODING_DEPTH16 )
+        CV_Error( CV_StsParseError, "Unsupported frame encoding" );
+    if ( header.rows <= 0 || header.cols <= 0 || header.dataType != CV_32FC3 )
+        CV_Error( CV_StsParseError, "Corrupted point cloud frame header" );
+
+    // Every offset is checked before it is summed, a crafted header must not
+    // wrap around and point the planes outside the blob
+    const uint64_t LIMIT = std::numeric_limits<uint64_t>::max() - FRAME_PLANE_ALIGN;
+    if ( header.dataOffset < FRAME_HEADER_SIZE || header.dataBytes == 0 ||
+         header.dataBytes > LIMIT - header.dataOffset )
+        CV_Error( CV_StsParseError, "Corrupted point cloud frame header" );
+    uint64_t dataEnd = header.dataOffset + header.dataBytes;
+    if ( header.bgrOffset < dataEnd || header.bgrBytes > LIMIT - header.bgrOffset ||
+         ( header.bgrType < 0 ) != ( header.bgrBytes == 0 ) )
+        CV_Error( CV_StsParseError, "Corrupted point cloud frame header" );
+    uint64_t end = alignUp( header.bgrOffset + header.bgrBytes, FRAME_PLANE_ALIGN );
+    if ( end > size )
+        CV_Error( CV_StsParseError, "Truncated point cloud frame" );
+    size_t total = static_cast<size_t>( end );
+
+    if ( verify && frameBlobChecksum( blob, total, header.version ) != header.checksum )
+        CV_Error( CV_StsParseError, "Point cloud frame checksum mismatch" );
+
+    if ( header.encoding == FRAME_ENCODING_DEPTH16 ){
+        if ( !( header.depthScale > 0.f ) ||
+             header.intrinsics[0] == 0.f || header.intrinsics[1] == 0.f )
+            CV_Error( CV_StsParseError, "Corrupted point cloud frame header" );
+
+        cv::Mat depth = decodePng( blob + header.dataOffset, header.dataBytes );
+        if ( depth.type() != CV_16UC1 || depth.rows != header.rows || depth.cols != header.cols )
+            CV_Error( CV_StsParseError, "Corrupted depth plane" );
+
+        // Never write into the matrices passed in, they may wrap another frame
+        cv::Mat xyz;
+        rebuildPoints( depth, header.intrinsics, header.depthScale, xyz );
+        data = xyz;
+
+        if ( header.bgrType >= 0 ){
+            bgr = decodePng( blob + header.bgrOffset, header.bgrBytes );
+            if ( bgr.type() != header.bgrType || bgr.rows != header.rows || bgr.cols != header.cols )
+                CV_Error( CV_StsParseError, "Corrupted colour plane" );
+        } else {
+            bgr.release();
+        }
+        return total;
+    }
+
+    // The plane sizes must match the geometry before any matrix wraps them
+    uint64_t pixels = static_cast<uint64_t>( header.rows )*static_cast<uint64_t>( header.cols );
+    if ( header.dataBytes != pixels*CV_ELEM_SIZE(CV_32FC3) ||
+         ( header.bgrType >= 0 &&
+           ( header.bgrType != CV_MAT_TYPE(header.bgrType) ||
+             header.bgrBytes != pixels*CV_ELEM_SIZE(header.bgrType) ) ) )
+        CV_Error( CV_StsParseError, "Corrupted point cloud frame header" );
+
+    data = cv::Mat( header.rows, header.cols, CV_32FC3, blob + header.dataOffset );
+    if ( header.bgrType >= 0 ){
+        bgr = cv::Mat( header.rows, header.cols, header.bgrType, blob + header.bgrOffset );
+    } else {
+        bgr.release();
+    }
+    return total;
+}
+
+void writeBlob( const std::string& name, const std::vector<uchar>& blob ){
+    FILE* f = std::fopen( name.c_str(), "wb" );
+    if ( !f )
+        CV_Error( CV_StsError, "Cannot create frame file " + name );
+
+    size_t written = std::fwrite( &blob[0], 1, blob.size(), f );
+    bool ok = ( std::fclose( f ) == 0 ) && written == blob.size();
+    if ( !ok )
+        CV_Error( CV_StsError, "Cannot write frame file " + name );
+}
+
+} // mcv
@@ -0,0 +1,315 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "FrameSequence.hpp"
+
+#include <cstring>
+
+namespace mcv {
+
+const char* const FRAME_SEQUENCE_EXTENSION = ".mcvs";
+
+enum { SEQUENCE_FORMAT_VERSION = 1,
+       SEQUENCE_BLOCK_SIZE     = 64 };
+
+static const char FILE_MAGIC[4]   = { 'M', 'C', 'V', 'S' };
+static const char CHUNK_MAGIC[4]  = { 'M', 'C', 'V', 'C' };
+static const char RECORD_MAGIC[4] = { 'M', 'C', 'V', 'R' };
+static const char FOOTER_MAGIC[4] = { 'M', 'C', 'V', 'I' };
+
+struct SequenceFileHeader
+{
+    char     magic[4];
+    uint32_t version;
+    uint8_t  reserved[SEQUENCE_BLOCK_SIZE - 8];
+};
+
+struct SequenceChunkHeader
+{
+    char     magic[4];
+    uint32_t frameCount;
+    uint64_t chunkBytes;    // including this header
+    uint8_t  reserved[SEQUENCE_BLOCK_SIZE - 16];
+};
+
+struct SequenceRecordHeader
+{
+    char     magic[4];
+    uint32_t reserved0;
+    double   timestamp;
+    uint64_t blobBytes;
+    uint8_t  reserved[SEQUENCE_BLOCK_SIZE - 24];
+};
+
+struct SequenceFooter
+{
+    char     magic[4];
+    uint32_t version;
+    uint64_t frameCount;
+    uint64_t indexOffset;
+    uint64_t indexChecksum;
+    uint8_t  reserved[SEQUENCE_BLOCK_SIZE - 32];
+};
+
+/*! FrameSequenceWriter */
+FrameSequenceWriter::FrameSequenceWriter( const std::string& name, FrameEncoding encoding,
+                                          size_t chunkBytes )
+  : m_file(0)
+  , m_encoding(encoding)
+  , m_offset(0)
+  , m_chunkBytes(chunkBytes)
+  , m_chunkFrames(0){
+    m_file = std::fopen( name.c_str(), "wb" );
+    if ( !m_file )
+        CV_Error( CV_StsError, "Cannot create frame sequence " + name );
+
+    SequenceFileHeader header;
+    std::memset( &header, 0, sizeof(header) );
+    std::memcpy( header.magic, FILE_MAGIC, 4 );
+    header.version = SEQUENCE_FORMAT_VERSION;
+    writeBytes( &header, sizeof(header) );
+}
+
+FrameSequenceWriter::~FrameSequenceWriter(){
+    try {
+        close();
+    } catch( ... ){
+        // never throw from a destructor, the index is simply missing
+    }
+}
+
+void FrameSequenceWriter::write( const cv::Mat& data, const cv::Mat& bgr, double timestamp ){
+    encodeFrame( data, bgr, m_scratch, m_encoding );
+    writeEncoded( m_scratch, timestamp );
+}
+
+void FrameSequenceWriter::writeEncoded( const std::vector<uchar>& blob, double timestamp ){
+    CV_Assert( m_file );
+    CV_Assert( !blob.empty() && blob.size() % SEQUENCE_BLOCK_SIZE == 0 );
+
+    SequenceRecordHeader record;
+    std::memset( &record, 0, sizeof(record) );
+    std::memcpy( record.magic, RECORD_MAGIC, 4 );
+    record.timestamp = timestamp;
+    record.blobBytes = blob.size();
+
+    size_t at = m_chunk.size();
+    m_chunk.resize( at + sizeof(record) + blob.size() );
+    std::memcpy( &m_chunk[at], &record, sizeof(record) );
+    std::memcpy( &m_chunk[at + sizeof(record)], &blob[0], blob.size() );
+
+    SequenceIndexEntry entry;
+    entry.offset    = m_offset + sizeof(SequenceChunkHeader) + at + sizeof(record);
+    entry.bytes     = blob.size();
+    entry.timestamp = timestamp;
+    m_index.push_back( entry );
+    m_chunkFrames++;
+
+    if ( m_chunk.size() >= m_chunkBytes )
+        flush();
+}
+
+void FrameSequenceWriter::flush(){
+    if ( !m_file || m_chunkFrames == 0 )
+        return;
+
+    SequenceChunkHeader chunk;
+    std::memset( &chunk, 0, sizeof(chunk) );
+    std::memcpy( chunk.magic, CHUNK_MAGIC, 4 );
+    chunk.frameCount = static_cast<uint32_t>( m_chunkFrames );
+    chunk.chunkBytes = sizeof(chunk) + m_chunk.size();
+
+    writeBytes( &chunk, sizeof(chunk) );
+    writeBytes( &m_chunk[0], m_chunk.size() );
+    std::fflush( m_file );
+
+    m_chunk.clear();
+    m_chunkFrames = 0;
+}
+
+void FrameSequenceWriter::close(){
+    if ( !m_file )
+        return;
+
+    flush();
+
+    SequenceFooter footer;
+    std::memset( &footer, 0, sizeof(footer) );
+    std::memcpy( footer.magic, FOOTER_MAGIC, 4 );
+    footer.version     = SEQUENCE_FORMAT_VERSION;
+    footer.frameCount  = m_index.size();
+    footer.indexOffset = m_offset;
+
+    size_t indexBytes = m_index.size()*sizeof(SequenceIndexEntry);
+    if ( indexBytes ){
+        footer.indexChecksum = frameChecksum( reinterpret_cast<const uchar*>(&m_index[0]), indexBytes );
+        writeBytes( &m_index[0], indexBytes );
+    }
+    writeBytes( &footer, sizeof(footer) );
+
+    FILE* f = m_file;
+    m_file = 0;
+    if ( std::fclose( f ) != 0 )
+        CV_Error( CV_StsError, "Cannot finalize frame sequence" );
+}
+
+bool FrameSequenceWriter::isOpened() const{
+    return m_file != 0;
+}
+
+size_t FrameSequenceWriter::frameCount() const{
+    return m_index.size();
+}
+
+void FrameSequenceWriter::writeBytes( const void* buffer, size_t size ){
+    if ( std::fwrite( buffer, 1, size, m_file ) != size )
+        CV_Error( CV_StsError, "Cannot write frame sequence" );
+    m_offset += size;
+}
+
+/*! FrameSequenceReader */
+FrameSequenceReader::FrameSequenceReader( const std::string& name, bool verifyFrames )
+  : m_file( new MappedFile(name) )
+  , m_position(0)
+  , m_verify(verifyFrames){
+    SequenceFileHeader header;
+    if ( m_file->size() < sizeof(header) )
+        CV_Error( CV_StsParseError, "Frame sequence is smaller than its header" );
+
+    std::memcpy( &header, m_file->data(), sizeof(header) );
+    if ( std::memcmp( header.magic, FILE_MAGIC, 4 ) != 0 )
+        CV_Error( CV_StsParseError, "Not a frame sequence: " + name );
+    if ( header.version > SEQUENCE_FORMAT_VERSION )
+        CV_Error( CV_StsParseError, "Unsupported frame sequence version" );
+
+    if ( !loadIndex() )
+        rebuildIndex();
+}
+
+size_t FrameSequenceReader::size() const{
+    return m_index.size();
+}
+
+double FrameSequenceReader::timestamp( size_t i ) const{
+    CV_Assert( i < m_index.size() );
+    return m_index[i].timestamp;
+}
+
+size_t FrameSequenceReader::tell() const{
+    return m_position;
+}
+
+void FrameSequenceReader::seek( size_t i ){
+    CV_Assert( i <= m_index.size() );
+    m_position = i;
+}
+
+bool FrameSequenceReader::read( cv::Mat& data, cv::Mat& bgr, double* timestamp ){
+    if ( m_position >= m_index.size() )
+        return false;
+
+    const SequenceIndexEntry& entry = m_index[m_position++];
+    decodeFrame( m_file->data() + entry.offset, entry.bytes, data, bgr, m_verify );
+    if ( timestamp )
+        *timestamp = entry.timestamp;
+    return true;
+}
+
+const cv::Ptr<MappedFile>& FrameSequenceReader::mapping() const{
+    return m_file;
+}
+
+bool FrameSequenceReader::loadIndex(){
+    size_t fileSize = m_file->size();
+    if ( fileSize < sizeof(SequenceFileHeader) + sizeof(SequenceFooter) )
+        return false;
+
+    SequenceFooter footer;
+    std::memcpy( &footer, m_file->data() + fileSize - sizeof(footer), sizeof(footer) );
+    if ( std::memcmp( footer.magic, FOOTER_MAGIC, 4 ) != 0 )
+        return false;
+
+    uint64_t indexBytes = footer.frameCount*sizeof(SequenceIndexEntry);
+    if ( footer.indexOffset + indexBytes + sizeof(footer) != fileSize )
+        return false;
+
+    const uchar* index = m_file->data() + footer.indexOffset;
+    if ( indexBytes && frameChecksum( index, indexBytes ) != footer.indexChecksum )
+        return false;
+
+    m_index.resize( footer.frameCount );
+    if ( indexBytes )
+        std::memcpy( &m_index[0], index, indexBytes );
+
+    for( size_t i=0; i<m_index.size(); i++ ){
+        if ( m_index[i].offset + m_index[i].bytes > footer.indexOffset ){
+            m_index.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void FrameSequenceReader::rebuildIndex(){
+    // Walk the chunks; a chunk cut short by an interrupted recording ends the walk
+    m_index.clear();
+    const uchar* base = m_file->data();
+    uint64_t fileSize = m_file->size();
+    uint64_t offset = sizeof(SequenceFileHeader);
+
+    while ( offset + sizeof(SequenceChunkHeader) <= fileSize ){
+        SequenceChunkHeader chunk;
+        std::memcpy( &chunk, base + offset, sizeof(chunk) );
+        if ( std::memcmp( chunk.magic, CHUNK_MAGIC, 4 ) != 0 ||
+             chunk.chunkBytes < sizeof(chunk) || offset + chunk.chunkBytes > fileSize )
+            break;
+
+        uint64_t end = offset + chunk.chunkBytes;
+        uint64_t at = offset + sizeof(chunk);
+        for( uint32_t i=0; i<chunk.frameCount && at + sizeof(SequenceRecordHeader) <= end; i++ ){
+            SequenceRecordHeader record;
+            std::memcpy( &record, base + at, sizeof(record) );
+            if ( std::memcmp( record.magic, RECORD_MAGIC, 4 ) != 0 )
+                break;
+
+            SequenceIndexEntry entry;
+            entry.offset    = at + sizeof(record);
+            entry.bytes     = record.blobBytes;
+            entry.timestamp = record.timestamp;
+            if ( entry.offset + entry.bytes > end )
+                break;
+            m_index.push_back( entry );
+            at = entry.offset + entry.bytes;
+        }
+        offset = end;
+    }
+}
+
+} // mcv
@@ -0,0 +1,329 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "FrameSource.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+/*! FrameSource */
+namespace mcv {
+
+double frameClock(){
+    return double( cv::getTickCount() ) / cv::getTickFrequency();
+}
+
+/*! Sleeps until frameClock() reaches t */
+static void waitUntil( double t ){
+    double remaining = t - frameClock();
+    if ( remaining > 0 )
+        std::this_thread::sleep_for( std::chrono::duration<double>( remaining ) );
+}
+
+bool retrieveOpenNIFrame( cv::VideoCapture& capture, cv::Mat& data, cv::Mat& bgr,
+                          bool grabColor ){
+    // retrieve copies into the buffer it is given, fresh matrices keep the
+    // caller's frame intact when either plane cannot be retrieved
+    cv::Mat frameData, frameBgr;
+    if ( grabColor && !capture.retrieve( frameBgr, CV_CAP_OPENNI_BGR_IMAGE ) )
+        return false;
+    if ( !capture.retrieve( frameData, CV_CAP_OPENNI_POINT_CLOUD_MAP ) || frameData.empty() )
+        return false;
+    data = frameData;
+    if ( grabColor )
+        bgr = frameBgr;
+    return true;
+}
+
+FrameSource::~FrameSource(){
+}
+
+cv::Ptr<MappedFile> FrameSource::mapping() const{
+    return cv::Ptr<MappedFile>();
+}
+
+/*! OpenNIFrameSource */
+OpenNIFrameSource::OpenNIFrameSource( int device )
+  : m_deviceId(device){
+}
+
+bool OpenNIFrameSource::open(){
+    if ( !m_device.isOpened() && !m_device.open( m_deviceId ) )
+        return false;
+    if ( m_deviceId == CV_CAP_OPENNI )
+        m_device.set( CV_CAP_OPENNI_IMAGE_GENERATOR_OUTPUT_MODE, CV_CAP_OPENNI_VGA_30HZ );
+    return true;
+}
+
+void OpenNIFrameSource::close(){
+    m_device.release();
+}
+
+bool OpenNIFrameSource::isOpened() const{
+    return m_device.isOpened();
+}
+
+bool OpenNIFrameSource::read( cv::Mat& data, cv::Mat& bgr, bool grabColor, double* timestamp ){
+    if ( !m_device.grab() || !retrieveOpenNIFrame( m_device, data, bgr, grabColor ) )
+        return false;
+    if ( timestamp )
+        *timestamp = frameClock();
+    return true;
+}
+
+cv::VideoCapture& OpenNIFrameSource::device(){
+    return m_device;
+}
+
+/*! SyntheticFrameSource */
+SyntheticPlane::SyntheticPlane( const cv::Vec3f& n, float d, const cv::Vec3b& c, float size )
+  : normal(n*( 1.f/float( cv::norm(n) ) ))
+  , distance(d/float( cv::norm(n) ))
+  , color(c)
+  , checker(size){
+}
+
+SyntheticSphere::SyntheticSphere( const cv::Vec3f& c, float r, const cv::Vec3b& bgr )
+  : center(c)
+  , radius(r)
+  , color(bgr){
+}
+
+SyntheticScene::SyntheticScene()
+  : size(640, 480)
+  , fx(525.f), fy(525.f)
+  , cx(319.5f), cy(239.5f)
+  , noise(0.0015f)
+  , invalidRatio(0.05f)
+  , seed(1)
+  , frameRate(30.0){
+    // Y points up in the OpenNI point cloud map: the floor is 0.8 m below
+    // the camera and the sphere centre slightly below the optical axis
+    planes.push_back( SyntheticPlane( cv::Vec3f(0,1,0), -0.8f, cv::Vec3b(200,220,200), 0.25f ) );
+    planes.push_back( SyntheticPlane( cv::Vec3f(0,0,-1), -3.f, cv::Vec3b(150,150,150) ) );
+    spheres.push_back( SyntheticSphere( cv::Vec3f(0.2f,-0.1f,1.6f), 0.35f, cv::Vec3b(64,64,255) ) );
+}
+
+SyntheticFrameSource::SyntheticFrameSource( const SyntheticScene& scene )
+  : m_scene(scene)
+  , m_isOpened(false)
+  , m_frame(0)
+  , m_nextDue(0){
+}
+
+bool SyntheticFrameSource::open(){
+    m_isOpened = true;
+    m_frame = 0;
+    m_nextDue = frameClock();
+    return true;
+}
+
+void SyntheticFrameSource::close(){
+    m_isOpened = false;
+}
+
+bool SyntheticFrameSource::isOpened() const{
+    return m_isOpened;
+}
+
+const SyntheticScene& SyntheticFrameSource::scene() const{
+    return m_scene;
+}
+
+uint64_t SyntheticFrameSource::frameIndex() const{
+    return m_frame;
+}
+
+bool SyntheticFrameSource::read( cv::Mat& data, cv::Mat& bgr, bool grabColor, double* timestamp ){
+    if ( !m_isOpened )
+        return false;
+    render( m_frame++, data, bgr, grabColor );
+
+    if ( m_scene.frameRate > 0 ){
+        waitUntil( m_nextDue );
+        // A late reader does not get a burst of frames to catch up
+        m_nextDue = std::max( m_nextDue, frameClock() - 1.0/m_scene.frameRate )
+                  + 1.0/m_scene.frameRate;
+    }
+    if ( timestamp )
+        *timestamp = frameClock();
+    return true;
+}
+
+void SyntheticFrameSource::render( uint64_t frame, cv::Mat& data, cv::Mat& bgr, bool grabColor ) const{
+    const SyntheticScene& s = m_scene;
+    data.create( s.size, CV_32FC3 );
+    if ( grabColor )
+        bgr.create( s.size, CV_8UC3 );
+
+    // In-plane axes of the checker patterns
+    std::vector<cv::Vec3f> tangents( 2*s.planes.size() );
+    for( size_t i=0; i<s.planes.size(); i++ ){
+        const cv::Vec3f& n = s.planes[i].normal;
+        cv::Vec3f axis = std::fabs( n[0] ) < 0.9f ? cv::Vec3f(1,0,0) : cv::Vec3f(0,1,0);
+        tangents[2*i]   = n.cross( axis );
+        tangents[2*i]  *= 1.f/float( cv::norm( tangents[2*i] ) );
+        tangents[2*i+1] = n.cross( tangents[2*i] );
+    }
+
+    parallelForRows( s.size.height, [&]( int begin, int end ){
+        for( int v=begin; v<end; v++ ){
+            // One generator per row and frame, whatever the band split
+            cv::RNG rng( ( s.seed*0x9E3779B97F4A7C15ull ) ^ ( frame*uint64_t( s.size.height ) + v + 1 ) );
+            cv::Vec3f* P = data.ptr<cv::Vec3f>(v);
+            cv::Vec3b* C = grabColor ? bgr.ptr<cv::Vec3b>(v) : 0;
+            for( int u=0; u<s.size.width; u++ ){
+                // Ray with unit Z, so the hit parameter is the depth. Image
+                // rows grow downwards while Y points up.
+                const cv::Vec3f ray( ( u - s.cx )/s.fx, ( s.cy - v )/s.fy, 1.f );
+                float z = 0;
+                cv::Vec3b color( 0, 0, 0 );
+
+                for( size_t i=0; i<s.planes.size(); i++ ){
+                    const SyntheticPlane& plane = s.planes[i];
+                    float cosine = plane.normal.dot( ray );
+                    if ( cosine == 0.f )
+                        continue;
+                    float t = plane.distance/cosine;
+                    if ( t <= 0 || ( z > 0 && t >= z ) )
+                        continue;
+                    z = t;
+                    color = plane.color;
+                    if ( plane.checker > 0 ){
+                        cv::Vec3f p = ray*t;
+                        int a = int( std::floor( p.dot( tangents[2*i] )/plane.checker ) );
+                        int b = int( std::floor( p.dot( tangents[2*i+1] )/plane.checker ) );
+                        if ( ( a + b ) & 1 )
+                            color = cv::Vec3b( color[0]/2, color[1]/2, color[2]/2 );
+                    }
+                }
+                for( size_t i=0; i<s.spheres.size(); i++ ){
+                    const SyntheticSphere& sphere = s.spheres[i];
+                    float a = ray.dot( ray ), b = ray.dot( sphere.center );
+                    float disc = b*b - a*( sphere.center.dot( sphere.center ) - sphere.radius*sphere.radius );
+                    if ( disc < 0 )
+                        continue;
+                    float t = ( b - std::sqrt( disc ) )/a;
+                    if ( t <= 0 || ( z > 0 && t >= z ) )
+                        continue;
+                    z = t;
+                    // Lit from the camera
+                    cv::Vec3f n = ( ray*t - sphere.center )*( 1.f/sphere.radius );
+                    float shade = std::max( 0.2f, -n.dot( ray )/std::sqrt( a ) );
+                    color = cv::Vec3b( cv::saturate_cast<uchar>( sphere.color[0]*shade ),
+                                       cv::saturate_cast<uchar>( sphere.color[1]*shade ),
+                                       cv::saturate_cast<uchar>( sphere.color[2]*shade ) );
+                }
+
+                // Both draws always happen, so the noise of a pixel does not
+                // depend on the scene content
+                float noise = float( rng.gaussian( s.noise ) );
+                bool invalid = rng.uniform( 0.f, 1.f ) < s.invalidRatio;
+                if ( z > 0 && !invalid )
+                    P[u] = ray*( z + noise*z*z );
+                else
+                    P[u] = cv::Vec3f( 0, 0, 0 );
+                if ( C )
+                    C[u] = color;
+            }
+        }
+    });
+}
+
+/*! ReplayFrameSource */
+ReplayFrameSource::ReplayFrameSource( const std::string& name, ReplayPacing pacing, bool loop )
+  : m_name(name)
+  , m_pacing(pacing)
+  , m_loop(loop)
+  , m_isStarted(false)
+  , m_clockStart(0)
+  , m_recordStart(0)
+  , m_recorded(0){
+}
+
+bool ReplayFrameSource::open(){
+    try {
+        m_reader = cv::Ptr<FrameSequenceReader>( new FrameSequenceReader( m_name ) );
+    }
+    catch( const cv::Exception& ){
+        m_reader.release();
+        return false;
+    }
+    m_isStarted = false;
+    return true;
+}
+
+void ReplayFrameSource::close(){
+    m_reader.release();
+}
+
+bool ReplayFrameSource::isOpened() const{
+    return !m_reader.empty();
+}
+
+bool ReplayFrameSource::read( cv::Mat& data, cv::Mat& bgr, bool grabColor, double* timestamp ){
+    if ( m_reader.empty() )
+        return false;
+    cv::Mat& color = grabColor ? bgr : m_scratch;
+    if ( !m_reader->read( data, color, &m_recorded ) ){
+        if ( !m_loop || m_reader->size() == 0 )
+            return false;
+        m_reader->seek( 0 );
+        m_isStarted = false;
+        if ( !m_reader->read( data, color, &m_recorded ) )
+            return false;
+    }
+    m_scratch.release();
+
+    if ( m_pacing == REPLAY_REALTIME ){
+        if ( !m_isStarted ){
+            m_isStarted = true;
+            m_clockStart = frameClock();
+            m_recordStart = m_recorded;
+        }
+        waitUntil( m_clockStart + ( m_recorded - m_recordStart ) );
+    }
+    if ( timestamp )
+        *timestamp = frameClock();
+    return true;
+}
+
+cv::Ptr<MappedFile> ReplayFrameSource::mapping() const{
+    return m_reader.empty() ? cv::Ptr<MappedFile>() : m_reader->mapping();
+}
+
+double ReplayFrameSource::recordedTimestamp() const{
+    return m_recorded;
+}
+
+} // mcv
@@ -0,0 +1,182 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "Normals.hpp"
+#include "Parallel.hpp"
+#include "PointCloud.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+/*! Normals */
+namespace mcv {
+
+enum { NORMALS_COLUMN_BLOCK     = 32,   // columns per band of the vertical pass
+       NORMALS_POWER_ITERATIONS = 3 };  // below 0.7 deg when l0 < 0.3*l1
+
+/*! Unit eigenvector of the smallest eigenvalue of a symmetric positive
+ *  semi-definite 3x3 matrix. The adjugate shares the eigenvectors of C with
+ *  eigenvalues l1*l2, l0*l2, l0*l1, so its largest column already points
+ *  close to the wanted direction; a few power iterations on it remove the
+ *  rest (the error shrinks by l0/l1 each time). No trigonometry, unlike the
+ *  closed-form eigenvalues, which dominated the cost per pixel. */
+static bool smallestEigenvector( double c00, double c01, double c02,
+                                 double c11, double c12, double c22,
+                                 cv::Vec3d& n ){
+    const cv::Vec3d r0( c00, c01, c02 ), r1( c01, c11, c12 ), r2( c02, c12, c22 );
+    const cv::Vec3d adj[3] = { r1.cross(r2), r2.cross(r0), r0.cross(r1) };
+    int best = 0;
+    double bestNorm = adj[0].dot( adj[0] );
+    for( int k=1; k<3; k++ ){
+        double norm2 = adj[k].dot( adj[k] );
+        if ( norm2 > bestNorm ){
+            best = k;
+            bestNorm = norm2;
+        }
+    }
+    // Two vanishing eigenvalues (collinear or coincident points)
+    if ( !( bestNorm > 0 ) )
+        return false;
+
+    // adj is symmetric: adj*v is the sum of its columns weighted by v. The
+    // entries are products of eigenvalues, a few iterations cannot leave
+    // the double range, so v is only normalized at the end.
+    cv::Vec3d v = adj[best];
+    for( int iteration=0; iteration<NORMALS_POWER_ITERATIONS; iteration++ )
+        v = adj[0]*v[0] + adj[1]*v[1] + adj[2]*v[2];
+    double norm2 = v.dot(v);
+    if ( !( norm2 > 0 ) )
+        return false;
+    n = v*( 1/std::sqrt(norm2) );
+    return true;
+}
+
+NormalEstimator::NormalEstimator( int radius, float minValidRatio ){
+    setRadius( radius );
+    setMinValidRatio( minValidRatio );
+}
+
+void NormalEstimator::setRadius( int radius ){
+    CV_Assert( radius > 0 );
+    m_radius = radius;
+}
+
+int NormalEstimator::getRadius() const{
+    return m_radius;
+}
+
+void NormalEstimator::setMinValidRatio( float minValidRatio ){
+    CV_Assert( minValidRatio >= 0 && minValidRatio <= 1 );
+    m_minValidRatio = minValidRatio;
+}
+
+float NormalEstimator::getMinValidRatio() const{
+    return m_minValidRatio;
+}
+
+void NormalEstimator::compute( const cv::Mat& points, cv::Mat& normals ){
+    CV_Assert( points.type() == CV_32FC3 );
+    const int rows = points.rows, cols = points.cols;
+    const int stride = cols + 1;
+    normals.create( points.size(), CV_32FC3 );
+    if ( points.empty() )
+        return;
+
+    // Integral images: row prefix sums in parallel over rows, then column
+    // prefix sums in parallel over blocks of columns
+    m_integral.resize( size_t(rows + 1)*stride );
+    Moments* I = &m_integral[0];
+    std::fill( I, I + stride, Moments() );
+    parallelForRows( rows, [&]( int begin, int end ){
+        for( int i=begin; i<end; i++ ){
+            const cv::Vec3f* P = points.ptr<cv::Vec3f>(i);
+            Moments* row = I + size_t(i + 1)*stride;
+            Moments sum = Moments();
+            row[0] = sum;
+            for( int j=0; j<cols; j++ ){
+                const cv::Vec3f& p = P[j];
+                if ( isValidPoint(p) ){
+                    const double x = p[0], y = p[1], z = p[2];
+                    sum.m[0] += 1;
+                    sum.m[1] += x;    sum.m[2] += y;    sum.m[3] += z;
+                    sum.m[4] += x*x;  sum.m[5] += x*y;  sum.m[6] += x*z;
+                    sum.m[7] += y*y;  sum.m[8] += y*z;  sum.m[9] += z*z;
+                }
+                row[j + 1] = sum;
+            }
+        }
+    });
+    const int blocks = ( cols + NORMALS_COLUMN_BLOCK - 1 )/NORMALS_COLUMN_BLOCK;
+    parallelForRows( blocks, [&]( int begin, int end ){
+        const int j0 = 1 + begin*NORMALS_COLUMN_BLOCK;
+        const int j1 = std::min( cols, end*NORMALS_COLUMN_BLOCK ) + 1;
+        for( int i=2; i<=rows; i++ ){
+            Moments* row = I + size_t(i)*stride;
+            const Moments* above = row - stride;
+            for( int j=j0; j<j1; j++ )
+                for( int k=0; k<10; k++ )
+                    row[j].m[k] += above[j].m[k];
+        }
+    }, 1 );
+
+    const int r = m_radius;
+    const double minCount = std::max( 3.0, double(m_minValidRatio)*(2*r + 1)*(2*r + 1) );
+    parallelForRows( rows, [&]( int begin, int end ){
+        for( int i=begin; i<end; i++ ){
+            const cv::Vec3f* P = points.ptr<cv::Vec3f>(i);
+            cv::Vec3f* N = normals.ptr<cv::Vec3f>(i);
+            const Moments* top = I + size_t( std::max( i - r, 0 ) )*stride;
+            const Moments* bottom = I + size_t( std::min( i + r + 1, rows ) )*stride;
+            for( int j=0; j<cols; j++ ){
+                N[j] = cv::Vec3f( 0, 0, 0 );
+                if ( !isValidPoint( P[j] ) )
+                    continue;
+                const int j0 = std::max( j - r, 0 ), j1 = std::min( j + r + 1, cols );
+                double s[10];
+                for( int k=0; k<10; k++ )
+                    s[k] = bottom[j1].m[k] - bottom[j0].m[k] - top[j1].m[k] + top[j0].m[k];
+                if ( s[0] < minCount )
+                    continue;
+
+                const double inv = 1/s[0];
+                const double mx = s[1]*inv, my = s[2]*inv, mz = s[3]*inv;
+                cv::Vec3d n;
+                if ( !smallestEigenvector( s[4]*inv - mx*mx, s[5]*inv - mx*my, s[6]*inv - mx*mz,
+                                           s[7]*inv - my*my, s[8]*inv - my*mz, s[9]*inv - mz*mz, n ) )
+                    continue;
+                if ( n[0]*P[j][0] + n[1]*P[j][1] + n[2]*P[j][2] > 0 )
+                    n = -n;
+                N[j] = cv::Vec3f( float(n[0]), float(n[1]), float(n[2]) );
+            }
+        }
+    });
+}
+
+} // mcv
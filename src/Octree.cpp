@@ -0,0 +1,447 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "Octree.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+/*! Octree */
+namespace mcv {
+
+enum { OCTREE_QUERY_GRAIN = 256 };   // query points per band
+
+static inline float sqrDistance( const cv::Vec3f& a, const cv::Vec3f& b ){
+    float dx = a[0]-b[0], dy = a[1]-b[1], dz = a[2]-b[2];
+    return dx*dx + dy*dy + dz*dz;
+}
+
+/*! Squared distance from a point to a box, 0 inside */
+static inline float sqrBoxDistance( const cv::Vec3f& p, const cv::Vec3f& pmin, const cv::Vec3f& pmax ){
+    float d2 = 0;
+    for( int k=0; k<3; k++ ){
+        float d = std::max( std::max( pmin[k] - p[k], p[k] - pmax[k] ), 0.f );
+        d2 += d*d;
+    }
+    return d2;
+}
+
+static inline int octantOf( const cv::Vec3f& p, const cv::Vec3f& center ){
+    return ( p[0] >= center[0] ) | ( ( p[1] >= center[1] ) << 1 ) | ( ( p[2] >= center[2] ) << 2 );
+}
+
+static inline cv::Vec3f childCenter( const cv::Vec3f& center, float half, int octant ){
+    float q = half*0.5f;
+    return cv::Vec3f( center[0] + ( octant & 1 ? q : -q ),
+                      center[1] + ( octant & 2 ? q : -q ),
+                      center[2] + ( octant & 4 ? q : -q ) );
+}
+
+Octree::Octree( int leafCapacity, int maxDepth ){
+    setLeafCapacity( leafCapacity );
+    setMaxDepth( maxDepth );
+}
+
+void Octree::setLeafCapacity( int leafCapacity ){
+    CV_Assert( leafCapacity > 0 );
+    m_leafCapacity = leafCapacity;
+}
+
+int Octree::getLeafCapacity() const{
+    return m_leafCapacity;
+}
+
+void Octree::setMaxDepth( int maxDepth ){
+    CV_Assert( maxDepth >= 0 );
+    m_maxDepth = maxDepth;
+}
+
+int Octree::getMaxDepth() const{
+    return m_maxDepth;
+}
+
+/*! Build */
+void Octree::build( const Point3Cloud& cloud ){
+    clear();
+    m_source = cloud.getCompactData();
+    const int count = m_source.rows;
+    if ( count == 0 )
+        return;
+
+    const cv::Vec3f* P = m_source.ptr<cv::Vec3f>();
+    m_points.assign( P, P + count );
+    m_indices.resize( count );
+    for( int n=0; n<count; n++ )
+        m_indices[n] = n;
+
+    // Root cube around the cached bounding box
+    const cv::Vec3f pmin = cloud.getBBMin(), pmax = cloud.getBBMax();
+    const cv::Vec3f center = ( pmin + pmax )*0.5f;
+    const float half = 0.5f*std::max( pmax[0]-pmin[0], std::max( pmax[1]-pmin[1], pmax[2]-pmin[2] ) );
+
+    std::vector<cv::Vec3f> pointScratch( count );
+    std::vector<int> indexScratch( count );
+    m_nodes.resize( 1 );
+    if ( count <= m_leafCapacity || m_maxDepth == 0 ){
+        buildSubtree( m_nodes, 0, 0, count, center, half, m_maxDepth, pointScratch, indexScratch );
+        return;
+    }
+
+    // Split the root here, then build the subtrees of its children in
+    // parallel, each into its own pool, and splice them after the root
+    Node& root = m_nodes[0];
+    root.pmin = pmin;
+    root.pmax = pmax;
+    root.begin = 0;
+    root.end = count;
+
+    int first[9];
+    splitRange( 0, count, center, first, pointScratch, indexScratch );
+    int octants[8], children = 0;
+    for( int o=0; o<8; o++ )
+        if ( first[o+1] > first[o] )
+            octants[children++] = o;
+    root.firstChild = 1;
+    root.childCount = children;
+
+    if ( m_subtrees.size() < 8 )
+        m_subtrees.resize( 8 );
+    parallelForBands( children, [&]( int c, int, int ){
+        const int o = octants[c];
+        std::vector<Node>& nodes = m_subtrees[c];
+        nodes.resize( 1 );
+        // Ranges are disjoint, so the scratch buffers can be shared
+        buildSubtree( nodes, 0, first[o], first[o+1], childCenter( center, half, o ),
+                      half*0.5f, 1, pointScratch, indexScratch );
+    }, 1 );
+
+    // Subtree roots become the root's children (1..children), the other
+    // nodes of subtree c follow each other, local node j at base[c] + j
+    int base[8], total = 1 + children;
+    for( int c=0; c<children; c++ ){
+        base[c] = total - 1;
+        total += int( m_subtrees[c].size() ) - 1;
+    }
+    m_nodes.resize( total );
+    for( int c=0; c<children; c++ ){
+        const std::vector<Node>& nodes = m_subtrees[c];
+        for( size_t j=0; j<nodes.size(); j++ ){
+            Node node = nodes[j];
+            if ( node.firstChild > 0 )
+                node.firstChild += base[c];
+            m_nodes[ j == 0 ? 1 + c : base[c] + int(j) ] = node;
+        }
+    }
+}
+
+void Octree::buildSubtree( std::vector<Node>& nodes, int slot, int begin, int end,
+                           const cv::Vec3f& center, float half, int depth,
+                           std::vector<cv::Vec3f>& pointScratch,
+                           std::vector<int>& indexScratch ){
+    Node node;
+    node.begin = begin;
+    node.end = end;
+    node.firstChild = -1;
+    node.childCount = 0;
+
+    if ( end - begin <= m_leafCapacity || depth >= m_maxDepth ){
+        node.pmin = node.pmax = m_points[begin];
+        for( int i=begin+1; i<end; i++ ){
+            for( int k=0; k<3; k++ ){
+                node.pmin[k] = std::min( node.pmin[k], m_points[i][k] );
+                node.pmax[k] = std::max( node.pmax[k], m_points[i][k] );
+            }
+        }
+        nodes[slot] = node;
+        return;
+    }
+
+    // Non-empty children are allocated next to each other, then filled
+    int first[9];
+    splitRange( begin, end, center, first, pointScratch, indexScratch );
+    node.firstChild = int(nodes.size());
+    for( int o=0; o<8; o++ )
+        node.childCount += first[o+1] > first[o];
+    nodes[slot] = node;
+    nodes.resize( nodes.size() + node.childCount );
+
+    int child = node.firstChild;
+    for( int o=0; o<8; o++ ){
+        if ( first[o+1] == first[o] )
+            continue;
+        buildSubtree( nodes, child++, first[o], first[o+1], childCenter( center, half, o ),
+                      half*0.5f, depth + 1, pointScratch, indexScratch );
+    }
+
+    // Tight bounds from the children, no second pass over the points
+    node.pmin = nodes[node.firstChild].pmin;
+    node.pmax = nodes[node.firstChild].pmax;
+    for( int c=1; c<node.childCount; c++ ){
+        const Node& other = nodes[node.firstChild + c];
+        for( int k=0; k<3; k++ ){
+            node.pmin[k] = std::min( node.pmin[k], other.pmin[k] );
+            node.pmax[k] = std::max( node.pmax[k], other.pmax[k] );
+        }
+    }
+    nodes[slot] = node;
+}
+
+void Octree::splitRange( int begin, int end, const cv::Vec3f& center, int first[9],
+                         std::vector<cv::Vec3f>& pointScratch,
+                         std::vector<int>& indexScratch ){
+    // Counting sort of the range by octant, stable
+    int counts[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    for( int i=begin; i<end; i++ )
+        counts[ octantOf( m_points[i], center ) ]++;
+    first[0] = begin;
+    for( int o=0; o<8; o++ )
+        first[o+1] = first[o] + counts[o];
+
+    int fill[8];
+    std::copy( first, first + 8, fill );
+    for( int i=begin; i<end; i++ ){
+        int j = fill[ octantOf( m_points[i], center ) ]++;
+        pointScratch[j] = m_points[i];
+        indexScratch[j] = m_indices[i];
+    }
+    std::copy( pointScratch.begin() + begin, pointScratch.begin() + end, m_points.begin() + begin );
+    std::copy( indexScratch.begin() + begin, indexScratch.begin() + end, m_indices.begin() + begin );
+}
+
+void Octree::clear(){
+    // The pools keep their capacity for the next build
+    m_source.release();
+    m_points.clear();
+    m_indices.clear();
+    m_nodes.clear();
+}
+
+bool Octree::empty() const{
+    return m_points.empty();
+}
+
+size_t Octree::size() const{
+    return m_points.size();
+}
+
+size_t Octree::nodeCount() const{
+    return m_nodes.size();
+}
+
+const cv::Mat& Octree::getPoints() const{
+    return m_source;
+}
+
+/*! Single queries */
+int Octree::nearestKSearch( const cv::Vec3f& query, int k, std::vector<int>& indices,
+                            std::vector<float>& sqrDistances ) const{
+    std::vector<Candidate> heap;
+    searchNearestK( query, k, FLT_MAX, heap );
+    indices.resize( heap.size() );
+    sqrDistances.resize( heap.size() );
+    for( size_t i=0; i<heap.size(); i++ ){
+        sqrDistances[i] = heap[i].first;
+        indices[i] = m_indices[ heap[i].second ];
+    }
+    return int(heap.size());
+}
+
+int Octree::radiusSearch( const cv::Vec3f& query, float radius, std::vector<int>& indices,
+                          std::vector<float>& sqrDistances ) const{
+    indices.clear();
+    sqrDistances.clear();
+    if ( !m_nodes.empty() )
+        searchRadius( 0, query, radius*radius, indices, &sqrDistances );
+    return int(indices.size());
+}
+
+int Octree::boxSearch( const cv::Vec3f& pmin, const cv::Vec3f& pmax,
+                       std::vector<int>& indices ) const{
+    indices.clear();
+    if ( !m_nodes.empty() )
+        searchBox( 0, pmin, pmax, indices );
+    return int(indices.size());
+}
+
+/*! Batched queries */
+void Octree::nearestKSearch( const cv::Mat& queries, int k, cv::Mat& indices,
+                             cv::Mat& sqrDistances ) const{
+    CV_Assert( k > 0 && ( queries.empty() || ( queries.type() == CV_32FC3 && queries.isContinuous() ) ) );
+    const int count = int( queries.total() );
+    indices.create( count, k, CV_32SC1 );
+    sqrDistances.create( count, k, CV_32FC1 );
+    if ( count == 0 )
+        return;
+
+    const cv::Vec3f* Q = queries.ptr<cv::Vec3f>();
+    parallelForRows( count, [&]( int begin, int end ){
+        std::vector<Candidate> heap;
+        heap.reserve( k );
+        for( int q=begin; q<end; q++ ){
+            // The previous neighbours bound the distance to the k-th one
+            float radius2 = FLT_MAX;
+            if ( q > begin && int(heap.size()) == k ){
+                radius2 = 0;
+                for( int i=0; i<k; i++ )
+                    radius2 = std::max( radius2, sqrDistance( Q[q], m_points[ heap[i].second ] ) );
+            }
+            searchNearestK( Q[q], k, radius2, heap );
+
+            int* idx = indices.ptr<int>(q);
+            float* dst = sqrDistances.ptr<float>(q);
+            for( int i=0; i<k; i++ ){
+                bool found = i < int(heap.size());
+                idx[i] = found ? m_indices[ heap[i].second ] : -1;
+                dst[i] = found ? heap[i].first : FLT_MAX;
+            }
+        }
+    }, OCTREE_QUERY_GRAIN );
+}
+
+void Octree::radiusSearch( const cv::Mat& queries, float radius,
+                           std::vector< std::vector<int> >& indices ) const{
+    CV_Assert( queries.empty() || ( queries.type() == CV_32FC3 && queries.isContinuous() ) );
+    const int count = int( queries.total() );
+    indices.resize( count );
+    if ( count == 0 )
+        return;
+
+    const cv::Vec3f* Q = queries.ptr<cv::Vec3f>();
+    const float radius2 = radius*radius;
+    parallelForRows( count, [&]( int begin, int end ){
+        for( int q=begin; q<end; q++ ){
+            indices[q].clear();
+            if ( !m_nodes.empty() )
+                searchRadius( 0, Q[q], radius2, indices[q], 0 );
+        }
+    }, OCTREE_QUERY_GRAIN );
+}
+
+/*! Traversals */
+void Octree::searchNearestK( const cv::Vec3f& query, int k, float radius2,
+                             std::vector<Candidate>& heap ) const{
+    heap.clear();
+    if ( k <= 0 || m_nodes.empty() )
+        return;
+    searchNearestK( 0, query, k, heap, radius2 );
+    std::sort_heap( heap.begin(), heap.end() );
+}
+
+void Octree::searchNearestK( int index, const cv::Vec3f& query, int k,
+                             std::vector<Candidate>& heap, float& radius2 ) const{
+    const Node& node = m_nodes[index];
+    if ( node.firstChild < 0 ){
+        for( int i=node.begin; i<node.end; i++ ){
+            float d2 = sqrDistance( query, m_points[i] );
+            if ( d2 > radius2 )
+                continue;
+            Candidate candidate( d2, i );
+            if ( int(heap.size()) < k ){
+                heap.push_back( candidate );
+                std::push_heap( heap.begin(), heap.end() );
+            } else if ( candidate < heap.front() ){
+                std::pop_heap( heap.begin(), heap.end() );
+                heap.back() = candidate;
+                std::push_heap( heap.begin(), heap.end() );
+            } else
+                continue;
+            if ( int(heap.size()) == k )
+                radius2 = std::min( radius2, heap.front().first );
+        }
+        return;
+    }
+
+    // Closest children first, so that the radius shrinks early (insertion
+    // sort, at most eight entries)
+    Candidate order[8];
+    for( int c=0; c<node.childCount; c++ ){
+        const Node& child = m_nodes[ node.firstChild + c ];
+        Candidate entry( sqrBoxDistance( query, child.pmin, child.pmax ), node.firstChild + c );
+        int j = c;
+        for( ; j>0 && entry < order[j-1]; j-- )
+            order[j] = order[j-1];
+        order[j] = entry;
+    }
+    for( int c=0; c<node.childCount; c++ ){
+        if ( order[c].first > radius2 )
+            break;
+        searchNearestK( order[c].second, query, k, heap, radius2 );
+    }
+}
+
+void Octree::searchRadius( int index, const cv::Vec3f& query, float radius2,
+                           std::vector<int>& indices, std::vector<float>* sqrDistances ) const{
+    const Node& node = m_nodes[index];
+    if ( sqrBoxDistance( query, node.pmin, node.pmax ) > radius2 )
+        return;
+    if ( node.firstChild < 0 ){
+        for( int i=node.begin; i<node.end; i++ ){
+            float d2 = sqrDistance( query, m_points[i] );
+            if ( d2 > radius2 )
+                continue;
+            indices.push_back( m_indices[i] );
+            if ( sqrDistances )
+                sqrDistances->push_back( d2 );
+        }
+        return;
+    }
+    for( int c=0; c<node.childCount; c++ )
+        searchRadius( node.firstChild + c, query, radius2, indices, sqrDistances );
+}
+
+void Octree::searchBox( int index, const cv::Vec3f& pmin, const cv::Vec3f& pmax,
+                        std::vector<int>& indices ) const{
+    const Node& node = m_nodes[index];
+    bool inside = true;
+    for( int k=0; k<3; k++ ){
+        if ( node.pmax[k] < pmin[k] || node.pmin[k] > pmax[k] )
+            return;
+        inside = inside && node.pmin[k] >= pmin[k] && node.pmax[k] <= pmax[k];
+    }
+    // Whole node inside the box: its points are one contiguous range
+    if ( inside ){
+        indices.insert( indices.end(), m_indices.begin() + node.begin, m_indices.begin() + node.end );
+        return;
+    }
+    if ( node.firstChild < 0 ){
+        for( int i=node.begin; i<node.end; i++ ){
+            const cv::Vec3f& P = m_points[i];
+            if ( P[0] >= pmin[0] && P[0] <= pmax[0] && P[1] >= pmin[1] && P[1] <= pmax[1] &&
+                 P[2] >= pmin[2] && P[2] <= pmax[2] )
+                indices.push_back( m_indices[i] );
+        }
+        return;
+    }
+    for( int c=0; c<node.childCount; c++ )
+        searchBox( node.firstChild + c, pmin, pmax, indices );
+}
+
+} // mcv
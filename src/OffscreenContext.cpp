@@ -0,0 +1,218 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "OffscreenContext.hpp"
+
+#ifdef MCV_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+
+/*! OffscreenContext */
+namespace mcv {
+
+#ifdef MCV_HAVE_EGL
+static EGLDisplay openDisplay(){
+    // Surfaceless Mesa needs neither X nor a DRM device
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>( eglGetProcAddress( "eglGetPlatformDisplayEXT" ) );
+    if ( getPlatformDisplay ){
+        EGLDisplay display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0 );
+        if ( display != EGL_NO_DISPLAY && eglInitialize( display, 0, 0 ) )
+            return display;
+    }
+    EGLDisplay display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+    if ( display != EGL_NO_DISPLAY && eglInitialize( display, 0, 0 ) )
+        return display;
+    return EGL_NO_DISPLAY;
+}
+
+OffscreenContext::OffscreenContext( const cv::Size& size )
+  : m_size(size)
+  , m_display(0)
+  , m_context(0)
+  , m_nextBuffer(0){
+    CV_Assert( size.width > 0 && size.height > 0 );
+    m_isPending[0] = m_isPending[1] = false;
+
+    EGLDisplay display = openDisplay();
+    if ( display == EGL_NO_DISPLAY )
+        CV_Error( CV_StsError, "No EGL display available" );
+    m_display = display;
+
+    // Surfaceless configurations only advertise pbuffers, the default
+    // EGL_WINDOW_BIT would match none
+    const EGLint configAttributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                                        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if ( !eglBindAPI( EGL_OPENGL_API ) ||
+         !eglChooseConfig( display, configAttributes, &config, 1, &configCount ) || configCount < 1 )
+        CV_Error( CV_StsError, "No EGL configuration supports desktop OpenGL" );
+
+    // Default attributes: a compatibility profile, the renderers use the
+    // fixed-function pipeline
+    EGLContext context = eglCreateContext( display, config, EGL_NO_CONTEXT, 0 );
+    if ( context == EGL_NO_CONTEXT )
+        CV_Error( CV_StsError, "Cannot create an EGL context" );
+    m_context = context;
+    if ( !eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ) ){
+        eglDestroyContext( display, context );
+        CV_Error( CV_StsError, "Surfaceless EGL contexts are not supported" );
+    }
+
+    glGenRenderbuffers( 1, &m_colorBufferId );
+    glBindRenderbuffer( GL_RENDERBUFFER, m_colorBufferId );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, size.width, size.height );
+    glGenRenderbuffers( 1, &m_depthBufferId );
+    glBindRenderbuffer( GL_RENDERBUFFER, m_depthBufferId );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size.width, size.height );
+    glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+    glGenFramebuffers( 1, &m_framebufferId );
+    glBindFramebuffer( GL_FRAMEBUFFER, m_framebufferId );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBufferId );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBufferId );
+    if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE ){
+        eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+        eglDestroyContext( display, context );
+        CV_Error( CV_StsError, "Incomplete offscreen framebuffer" );
+    }
+
+    // Storage allocated once, rows packed without padding
+    glGenBuffers( 2, m_pixelBufferIds );
+    for( int i=0; i<2; i++ ){
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, m_pixelBufferIds[i] );
+        glBufferData( GL_PIXEL_PACK_BUFFER, size.area()*3, 0, GL_STREAM_READ );
+    }
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+}
+
+OffscreenContext::~OffscreenContext(){
+    makeCurrent();
+    glDeleteBuffers( 2, m_pixelBufferIds );
+    glDeleteFramebuffers( 1, &m_framebufferId );
+    glDeleteRenderbuffers( 1, &m_colorBufferId );
+    glDeleteRenderbuffers( 1, &m_depthBufferId );
+    // The display is left initialized, other contexts may share it
+    eglMakeCurrent( m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+    eglDestroyContext( m_display, m_context );
+}
+
+bool OffscreenContext::isAvailable(){
+    return true;
+}
+
+void OffscreenContext::makeCurrent(){
+    if ( eglGetCurrentContext() != m_context )
+        eglMakeCurrent( m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context );
+}
+
+void OffscreenContext::beginFrame(){
+    glBindFramebuffer( GL_FRAMEBUFFER, m_framebufferId );
+    glViewport( 0, 0, m_size.width, m_size.height );
+}
+
+void OffscreenContext::endFrame(){
+    glBindFramebuffer( GL_READ_FRAMEBUFFER, m_framebufferId );
+    glReadBuffer( GL_COLOR_ATTACHMENT0 );
+    glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, m_pixelBufferIds[m_nextBuffer] );
+    glReadPixels( 0, 0, m_size.width, m_size.height, GL_BGR, GL_UNSIGNED_BYTE, 0 );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    glFlush();
+
+    m_isPending[m_nextBuffer] = true;
+    m_nextBuffer = 1 - m_nextBuffer;
+}
+
+bool OffscreenContext::retrieveFrame( cv::Mat& image, bool wait ){
+    // m_nextBuffer holds the frame before the last one
+    int buffer = m_nextBuffer;
+    if ( !m_isPending[buffer] ){
+        buffer = 1 - m_nextBuffer;
+        if ( !wait || !m_isPending[buffer] )
+            return false;
+    }
+
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, m_pixelBufferIds[buffer] );
+    const void* pixels = glMapBuffer( GL_PIXEL_PACK_BUFFER, GL_READ_ONLY );
+    bool mapped = pixels != 0;
+    if ( mapped ){
+        // GL rows go bottom-up
+        cv::Mat rows( m_size, CV_8UC3, const_cast<void*>(pixels) );
+        cv::flip( rows, image, 0 );
+        glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+    }
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    m_isPending[buffer] = false;
+    return mapped;
+}
+
+#else
+
+OffscreenContext::OffscreenContext( const cv::Size& size )
+  : m_size(size)
+  , m_display(0)
+  , m_context(0)
+  , m_nextBuffer(0){
+    CV_Error( CV_StsNotImplemented, "Built without EGL, offscreen rendering is unavailable" );
+}
+
+OffscreenContext::~OffscreenContext(){
+}
+
+bool OffscreenContext::isAvailable(){
+    return false;
+}
+
+void OffscreenContext::makeCurrent(){
+}
+
+void OffscreenContext::beginFrame(){
+}
+
+void OffscreenContext::endFrame(){
+}
+
+bool OffscreenContext::retrieveFrame( cv::Mat&, bool ){
+    return false;
+}
+
+#endif
+
+const cv::Size& OffscreenContext::size() const{
+    return m_size;
+}
+
+} // mcv
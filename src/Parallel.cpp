@@ -0,0 +1,233 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "Parallel.hpp"
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace mcv {
+
+namespace {
+
+/*! True on pool workers and on a caller while it runs bands */
+thread_local bool t_insideBand = false;
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool( int threads )
+      : m_body(0)
+      , m_rows(0)
+      , m_grain(1)
+      , m_bands(0)
+      , m_next(0)
+      , m_pending(0)
+      , m_generation(0)
+      , m_stop(false){
+        for( int i=1; i<threads; i++ )
+            m_workers.push_back( std::thread( &ThreadPool::workerLoop, this ) );
+    }
+
+    ~ThreadPool(){
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for( size_t i=0; i<m_workers.size(); i++ )
+            m_workers[i].join();
+    }
+
+    int threads() const{
+        return static_cast<int>( m_workers.size() ) + 1;
+    }
+
+    /*! Runs the loop, returns false if the pool is busy with another one */
+    bool tryRun( int rows, int grain, const std::function<void(int,int,int)>& body ){
+        std::unique_lock<std::mutex> busy( m_submit, std::try_to_lock );
+        if ( !busy.owns_lock() )
+            return false;
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_body    = &body;
+            m_rows    = rows;
+            m_grain   = grain;
+            m_bands   = bandCount( rows, grain );
+            m_next    = 0;
+            m_pending = static_cast<int>( m_workers.size() );
+            m_error   = std::exception_ptr();
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        work();
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_done.wait( lock, [this]{ return m_pending == 0; } );
+            m_body = 0;
+            error = m_error;
+        }
+        if ( error )
+            std::rethrow_exception( error );
+        return true;
+    }
+
+private:
+    void workerLoop(){
+        t_insideBand = true;
+        uint64_t seen = 0;
+        for(;;){
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_wake.wait( lock, [&]{ return m_stop || m_generation != seen; } );
+                if ( m_stop )
+                    return;
+                seen = m_generation;
+            }
+
+            work();
+
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if ( --m_pending == 0 )
+                m_done.notify_all();
+        }
+    }
+
+    void work(){
+        bool inside = t_insideBand;
+        t_insideBand = true;
+        for(;;){
+            int band = m_next.fetch_add( 1 );
+            if ( band >= m_bands )
+                break;
+            int begin = band*m_grain;
+            int end = std::min( begin + m_grain, m_rows );
+            try {
+                (*m_body)( band, begin, end );
+            } catch( ... ){
+                std::lock_guard<std::mutex> lock( m_mutex );
+                if ( !m_error )
+                    m_error = std::current_exception();
+            }
+        }
+        t_insideBand = inside;
+    }
+
+    std::vector<std::thread>                  m_workers;
+    std::mutex                                m_submit;     // one loop at a time
+    std::mutex                                m_mutex;
+    std::condition_variable                   m_wake;
+    std::condition_variable                   m_done;
+
+    const std::function<void(int,int,int)>*   m_body;
+    int                                       m_rows;
+    int                                       m_grain;
+    int                                       m_bands;
+    std::atomic<int>                          m_next;
+    int                                       m_pending;    // workers still in the loop
+    uint64_t                                  m_generation;
+    bool                                      m_stop;
+    std::exception_ptr                        m_error;
+};
+
+std::mutex g_poolMutex;
+std::shared_ptr<ThreadPool> g_pool;
+int g_threads = 0;      // 0: one per core
+
+int defaultThreads(){
+    return std::max( 1, static_cast<int>( std::thread::hardware_concurrency() ) );
+}
+
+std::shared_ptr<ThreadPool> pool(){
+    std::lock_guard<std::mutex> lock( g_poolMutex );
+    int threads = g_threads > 0 ? g_threads : defaultThreads();
+    if ( threads > 1 && !g_pool )
+        g_pool = std::make_shared<ThreadPool>( threads );
+    return g_pool;
+}
+
+} // anonymous
+
+void setNumThreads( int threads ){
+    std::shared_ptr<ThreadPool> old;
+    {
+        std::lock_guard<std::mutex> lock( g_poolMutex );
+        g_threads = std::max( threads, 0 );
+        old.swap( g_pool );     // rebuilt on next use with the new size
+    }
+    // A loop still running on the old pool keeps it alive until it ends
+}
+
+int getNumThreads(){
+    std::lock_guard<std::mutex> lock( g_poolMutex );
+    return g_threads > 0 ? g_threads : defaultThreads();
+}
+
+int bandCount( int rows, int grain ){
+    grain = std::max( grain, 1 );
+    return rows > 0 ? ( rows + grain - 1 ) / grain : 0;
+}
+
+void parallelForBands( int rows, const std::function<void(int,int,int)>& body, int grain ){
+    grain = std::max( grain, 1 );
+    int bands = bandCount( rows, grain );
+    if ( bands == 0 )
+        return;
+
+    if ( bands > 1 && !t_insideBand ){
+        std::shared_ptr<ThreadPool> p = pool();
+        if ( p && p->tryRun( rows, grain, body ) )
+            return;
+    }
+
+    // Serial: same bands, in order, on the calling thread
+    for( int band=0; band<bands; band++ ){
+        int begin = band*grain;
+        body( band, begin, std::min( begin + grain, rows ) );
+    }
+}
+
+void parallelForRows( int rows, const std::function<void(int,int)>& body, int grain ){
+    parallelForBands( rows, [&]( int, int begin, int end ){
+        body( begin, end );
+    }, grain );
+}
+
+} // mcv
@@ -0,0 +1,288 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "PlaneDetector.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+/*! PlaneDetector */
+namespace mcv {
+
+enum { PLANE_RANDOM_SEED      = 0x5EED,
+       PLANE_HYPOTHESIS_GRAIN = 4 };    // hypotheses per band
+
+/*! Sums for a least-squares plane: count, coordinates, pairwise products */
+struct PlaneMoments
+{
+    double count;
+    double s[3];
+    double ss[6];   // xx, xy, xz, yy, yz, zz
+};
+
+static void clearMoments( PlaneMoments& m ){
+    m.count = 0;
+    for( int k=0; k<3; k++ )
+        m.s[k] = 0;
+    for( int k=0; k<6; k++ )
+        m.ss[k] = 0;
+}
+
+static void addMoments( PlaneMoments& m, const cv::Vec3f& p ){
+    const double x = p[0], y = p[1], z = p[2];
+    m.count += 1;
+    m.s[0] += x;    m.s[1] += y;    m.s[2] += z;
+    m.ss[0] += x*x; m.ss[1] += x*y; m.ss[2] += x*z;
+    m.ss[3] += y*y; m.ss[4] += y*z; m.ss[5] += z*z;
+}
+
+static void joinMoments( PlaneMoments& m, const PlaneMoments& part ){
+    m.count += part.count;
+    for( int k=0; k<3; k++ )
+        m.s[k] += part.s[k];
+    for( int k=0; k<6; k++ )
+        m.ss[k] += part.ss[k];
+}
+
+/*! Total least squares plane through the points summed in m, the normal
+ *  facing the camera (origin) */
+static bool fitPlane( const PlaneMoments& m, cv::Vec3f& normal, cv::Vec3f& centroid ){
+    if ( m.count < 3 )
+        return false;
+    const double inv = 1/m.count;
+    const double cx = m.s[0]*inv, cy = m.s[1]*inv, cz = m.s[2]*inv;
+    cv::Matx33d C( m.ss[0]*inv - cx*cx, m.ss[1]*inv - cx*cy, m.ss[2]*inv - cx*cz,
+                   m.ss[1]*inv - cx*cy, m.ss[3]*inv - cy*cy, m.ss[4]*inv - cy*cz,
+                   m.ss[2]*inv - cx*cz, m.ss[4]*inv - cy*cz, m.ss[5]*inv - cz*cz );
+    cv::Mat values, vectors;
+    cv::eigen( cv::Mat(C), values, vectors );   // descending eigenvalues
+    cv::Vec3d n( vectors.at<double>(2,0), vectors.at<double>(2,1), vectors.at<double>(2,2) );
+    if ( n[0]*cx + n[1]*cy + n[2]*cz > 0 )
+        n = -n;
+    normal = cv::Vec3f( float(n[0]), float(n[1]), float(n[2]) );
+    centroid = cv::Vec3f( float(cx), float(cy), float(cz) );
+    return true;
+}
+
+PlaneDetector::PlaneDetector()
+  : m_distance(0.02f)
+  , m_angle(float(CV_PI/12))
+  , m_hypotheses(64)
+  , m_step(4)
+  , m_minRatio(0.1f)
+  , m_normalEstimator(2){
+}
+
+void PlaneDetector::setDistanceThreshold( float distance ){
+    CV_Assert( distance > 0 );
+    m_distance = distance;
+}
+
+float PlaneDetector::getDistanceThreshold() const{
+    return m_distance;
+}
+
+void PlaneDetector::setAngleThreshold( float angle ){
+    CV_Assert( angle > 0 );
+    m_angle = angle;
+}
+
+float PlaneDetector::getAngleThreshold() const{
+    return m_angle;
+}
+
+void PlaneDetector::setHypotheses( int hypotheses ){
+    CV_Assert( hypotheses > 0 );
+    m_hypotheses = hypotheses;
+}
+
+int PlaneDetector::getHypotheses() const{
+    return m_hypotheses;
+}
+
+void PlaneDetector::setSampleStep( int step ){
+    CV_Assert( step > 0 );
+    m_step = step;
+}
+
+int PlaneDetector::getSampleStep() const{
+    return m_step;
+}
+
+void PlaneDetector::setMinInlierRatio( float ratio ){
+    CV_Assert( ratio >= 0 && ratio <= 1 );
+    m_minRatio = ratio;
+}
+
+float PlaneDetector::getMinInlierRatio() const{
+    return m_minRatio;
+}
+
+bool PlaneDetector::detect( const Point3Cloud& cloud, PlaneModel& plane ){
+    const cv::Mat& points = cloud.getDataView();
+    plane.inliers.release();
+    plane.inlierCount = 0;
+    if ( points.empty() )
+        return false;
+    CV_Assert( points.type() == CV_32FC3 );
+
+    // Subsampled grid and its normals
+    const int step = m_step;
+    const bool cloudNormals = cloud.hasNormals();
+    const cv::Mat& normals = cloud.getNormalsView();
+    m_samplePoints.create( ( points.rows + step - 1 )/step, ( points.cols + step - 1 )/step, CV_32FC3 );
+    if ( cloudNormals )
+        m_sampleNormals.create( m_samplePoints.size(), CV_32FC3 );
+    for( int i=0; i<m_samplePoints.rows; i++ ){
+        cv::Vec3f* P = m_samplePoints.ptr<cv::Vec3f>(i);
+        cv::Vec3f* N = cloudNormals ? m_sampleNormals.ptr<cv::Vec3f>(i) : 0;
+        for( int j=0; j<m_samplePoints.cols; j++ ){
+            P[j] = points.at<cv::Vec3f>( i*step, j*step );
+            if ( N )
+                N[j] = normals.at<cv::Vec3f>( i*step, j*step );
+        }
+    }
+    if ( !cloudNormals )
+        m_normalEstimator.compute( m_samplePoints, m_sampleNormals );
+
+    m_points.clear();
+    m_normals.clear();
+    for( int i=0; i<m_samplePoints.rows; i++ ){
+        const cv::Vec3f* P = m_samplePoints.ptr<cv::Vec3f>(i);
+        const cv::Vec3f* N = m_sampleNormals.ptr<cv::Vec3f>(i);
+        for( int j=0; j<m_samplePoints.cols; j++ ){
+            if ( isValidPoint( P[j] ) && isValidPoint( N[j] ) ){
+                m_points.push_back( P[j] );
+                m_normals.push_back( N[j] );
+            }
+        }
+    }
+    const int samples = int( m_points.size() );
+    if ( samples < 3 )
+        return false;
+
+    // One point and its normal per hypothesis, scored in parallel
+    cv::RNG rng( PLANE_RANDOM_SEED );
+    std::vector<int> seeds( m_hypotheses ), support( m_hypotheses );
+    for( int h=0; h<m_hypotheses; h++ )
+        seeds[h] = rng.uniform( 0, samples );
+    const float distance = m_distance;
+    const float minCos = std::cos( m_angle );
+    parallelForRows( m_hypotheses, [&]( int begin, int end ){
+        for( int h=begin; h<end; h++ ){
+            const cv::Vec3f& n = m_normals[ seeds[h] ];
+            const float d = -n.dot( m_points[ seeds[h] ] );
+            int count = 0;
+            for( int i=0; i<samples; i++ )
+                count += std::fabs( n.dot( m_points[i] ) + d ) <= distance &&
+                         n.dot( m_normals[i] ) >= minCos;
+            support[h] = count;
+        }
+    }, PLANE_HYPOTHESIS_GRAIN );
+
+    int best = 0;
+    for( int h=1; h<m_hypotheses; h++ )
+        if ( support[h] > support[best] )
+            best = h;
+
+    // Least squares on the sample inliers of the winner
+    cv::Vec3f n = m_normals[ seeds[best] ];
+    float d = -n.dot( m_points[ seeds[best] ] );
+    PlaneMoments sampleMoments;
+    clearMoments( sampleMoments );
+    for( int i=0; i<samples; i++ )
+        if ( std::fabs( n.dot( m_points[i] ) + d ) <= distance && n.dot( m_normals[i] ) >= minCos )
+            addMoments( sampleMoments, m_points[i] );
+    cv::Vec3f centroid;
+    if ( !fitPlane( sampleMoments, n, centroid ) )
+        return false;
+    d = -n.dot( centroid );
+
+    // Refit on the full grid, then the full resolution mask, with the same
+    // criterion as the scoring: without a normals plane, a pixel takes the
+    // normal of the nearest sample
+    PlaneMoments init;
+    clearMoments( init );
+    const int lastRow = m_sampleNormals.rows - 1, lastCol = m_sampleNormals.cols - 1;
+    auto normalAt = [&]( int i, int j ) -> const cv::Vec3f& {
+        if ( cloudNormals )
+            return normals.at<cv::Vec3f>( i, j );
+        return m_sampleNormals.at<cv::Vec3f>( std::min( ( i + step/2 )/step, lastRow ),
+                                              std::min( ( j + step/2 )/step, lastCol ) );
+    };
+    auto isInlier = [&]( int i, int j, const cv::Vec3f& p ){
+        return isValidPoint(p) && std::fabs( n.dot(p) + d ) <= distance &&
+               n.dot( normalAt( i, j ) ) >= minCos;
+    };
+    PlaneMoments full = parallelReduceRows( points.rows, init,
+        [&]( int begin, int end, PlaneMoments& acc ){
+            for( int i=begin; i<end; i++ ){
+                const cv::Vec3f* P = points.ptr<cv::Vec3f>(i);
+                for( int j=0; j<points.cols; j++ )
+                    if ( isInlier( i, j, P[j] ) )
+                        addMoments( acc, P[j] );
+            }
+        }, joinMoments );
+    if ( !fitPlane( full, n, centroid ) )
+        return false;
+    d = -n.dot( centroid );
+
+    plane.inliers = cv::Mat( points.size(), CV_8UC1 );
+    plane.inlierCount = parallelReduceRows( points.rows, 0,
+        [&]( int begin, int end, int& count ){
+            for( int i=begin; i<end; i++ ){
+                const cv::Vec3f* P = points.ptr<cv::Vec3f>(i);
+                uchar* M = plane.inliers.ptr<uchar>(i);
+                for( int j=0; j<points.cols; j++ ){
+                    M[j] = isInlier( i, j, P[j] ) ? 255 : 0;
+                    count += M[j] != 0;
+                }
+            }
+        },
+        []( int& count, const int& part ){ count += part; } );
+
+    plane.coefficients = cv::Vec4f( n[0], n[1], n[2], d );
+    plane.centroid = centroid;
+
+    // Plane frame: Z along the normal, X from the cloud X axis
+    cv::Vec3f x = cv::Vec3f(1,0,0) - n*n[0];
+    if ( x.dot(x) < 1e-6f )
+        x = cv::Vec3f(0,1,0) - n*n[1];
+    x *= 1.f/std::sqrt( x.dot(x) );
+    cv::Vec3f y = n.cross(x);
+    plane.pose = Transformation( cv::Matx33f( x[0], y[0], n[0],
+                                              x[1], y[1], n[1],
+                                              x[2], y[2], n[2] ), centroid );
+
+    return plane.inlierCount >= m_minRatio*cloud.getValidCount() && plane.inlierCount >= 3;
+}
+
+} // mcv
@@ -29,43 +29,170 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //M*/
 
 #include "PointCloud.hpp"
+#include "PointKernels.hpp"
+#include "Parallel.hpp"
+#include "Normals.hpp"
+#include "Profiler.hpp"
+#include "FrameSource.hpp"
+
+#include <cfloat>
+#include <functional>
+#include <utility>
 
 /*! PointCloud class */
 namespace mcv {
 
+/*! True when writing into m could be seen through another matrix header */
+static bool isShared( const cv::Mat& m ){
+#if CV_MAJOR_VERSION < 3
+    return m.refcount == 0 || *m.refcount > 1;
+#else
+    return m.u == 0 || m.u->refcount > 1;
+#endif
+}
+
+/*! True when m wraps memory of the file */
+static bool pointsInto( const cv::Mat& m, const MappedFile& file ){
+    return !m.empty() && m.data >= file.data() && m.data < file.data() + file.size();
+}
+
+/*! Points per band when working on the compact N x 1 arrays */
+static const int COMPACT_GRAIN = 8192;
+
+/*! Calls fn(points, count) on packed runs of an XYZ plane, row bands in parallel */
+template<typename Fn>
+static void forPackedRows( cv::Mat& data, const Fn& fn, int grain = PARALLEL_DEFAULT_GRAIN ){
+    CV_Assert( data.empty() || data.type() == CV_32FC3 );
+    const bool packed = data.isContinuous();
+    parallelForRows( data.rows, [&]( int begin, int end ){
+        if ( packed ){
+            fn( data.ptr<float>(begin), size_t(end - begin)*data.cols );
+            return;
+        }
+        for( int i=begin; i<end; i++ )
+            fn( data.ptr<float>(i), size_t(data.cols) );
+    }, grain );
+}
+
+/*! Partial bounds of a row band */
+struct BoundsAccumulator
+{
+    cv::Vec3f pmin, pmax;
+    cv::Vec3d sum;
+    double    count;
+};
+
+static void accumulateBounds( const cv::Vec3f* P, int count, BoundsAccumulator& acc ){
+    for( int j=0; j<count; j++ ){
+        if ( !isValidPoint(P[j]) )
+            continue;
+        for( int k=0; k<3; k++ ){
+            acc.pmin[k] = std::min( acc.pmin[k], P[j][k] );
+            acc.pmax[k] = std::max( acc.pmax[k], P[j][k] );
+            acc.sum[k] += P[j][k];
+        }
+        acc.count++;
+    }
+}
+
 /*! Constructors */    
 Point3Cloud::Point3Cloud(){
+    invalidateCache();
 }
 
-Point3Cloud::Point3Cloud(const Point3Cloud &cloud){
-    cloud.getBgr(bgr);
-    cloud.getData(data);
-    computeCenter();
+Point3Cloud::Point3Cloud(const Point3Cloud &cloud)
+  : data(cloud.data)
+  , bgr(cloud.bgr)
+  , normals(cloud.normals)
+  , storage(cloud.storage)
+  , bounds(cloud.bounds)
+  , compact(cloud.compact){
+}
+
+Point3Cloud::Point3Cloud( Point3Cloud&& cloud ){
+    invalidateCache();
+    swap( cloud );
 }
 
 Point3Cloud::Point3Cloud( const cv::Mat& data_ ){
     data = data_.clone();
-    computeCenter();
+    invalidateCache();
 }
 
 Point3Cloud::Point3Cloud( const cv::Mat& data_, const cv::Mat& bgr_ ){
     data = data_.clone();
     bgr = bgr_.clone();
-    computeCenter();
+    invalidateCache();
+}
+
+Point3Cloud::Point3Cloud( cv::Mat&& data_, cv::Mat&& bgr_ ){
+    invalidateCache();
+    setData( std::move(data_) );
+    setBgr( std::move(bgr_) );
 }
 
 /*! Destructors */   
 Point3Cloud::~Point3Cloud(){
 }
 
+Point3Cloud Point3Cloud::fromDepth( const cv::Mat& depth, const CameraCalibration& calibration,
+                                    const cv::Mat& bgr, float depthScale ){
+    CV_Assert( bgr.empty() || bgr.size() == depth.size() );
+    cv::Mat xyz;
+    backprojectDepth( depth, calibration, xyz, depthScale );
+    cv::Mat colours = bgr.clone();
+    return Point3Cloud( std::move(xyz), std::move(colours) );
+}
+
+/*! Assignment */
+Point3Cloud& Point3Cloud::operator=( const Point3Cloud& cloud ){
+    if ( this != &cloud ){
+        data = cloud.data;
+        bgr = cloud.bgr;
+        normals = cloud.normals;
+        storage = cloud.storage;
+        bounds = cloud.bounds;
+        compact = cloud.compact;
+    }
+    return *this;
+}
+
+Point3Cloud& Point3Cloud::operator=( Point3Cloud&& cloud ){
+    swap( cloud );
+    return *this;
+}
+
+Point3Cloud Point3Cloud::clone() const{
+    Point3Cloud copy( *this );
+    copy.data = data.clone();
+    copy.bgr = bgr.clone();
+    copy.normals = normals.clone();
+    copy.storage.release();
+    return copy;
+}
+
 /*! Setters */
 void Point3Cloud::setData( const cv::Mat& data_ ){
     data = data_.clone();
-    computeCenter();
+    invalidateCache();
 }
 
 void Point3Cloud::setBgr( const cv::Mat& bgr_ ){
     bgr = bgr_.clone();
+    releaseCompact();
+}
+
+void Point3Cloud::setData( cv::Mat&& data_ ){
+    // cv::Mat has no move constructor: share, then drop the caller's reference
+    data = data_;
+    data_.release();
+    invalidateCache();
+}
+
+void Point3Cloud::setBgr( cv::Mat&& bgr_ ){
+    bgr = bgr_;
+    bgr_.release();
+    releaseCompact();
 }
 
 /*! Getters */
@@ -76,61 +203,175 @@ void Point3Cloud::getData( cv::Mat& data_ ) const{
 void Point3Cloud::getBgr( cv::Mat& bgr_ ) const{
     bgr_ = bgr.clone();
 }
+
+const cv::Mat& Point3Cloud::getDataView() const{
+    return data;
+}
+
+const cv::Mat& Point3Cloud::getBgrView() const{
+    return bgr;
+}
+
+/*! Normals */
+void Point3Cloud::computeNormals( int radius ){
+    NormalEstimator estimator( radius );
+    computeNormals( estimator );
+}
+
+void Point3Cloud::computeNormals( NormalEstimator& estimator ){
+    // Fresh plane: the current one may be shared with a copy
+    cv::Mat result;
+    estimator.compute( data, result );
+    normals = result;
+}
+
+bool Point3Cloud::hasNormals() const{
+    return !normals.empty();
+}
+
+void Point3Cloud::getNormals( cv::Mat& normals_ ) const{
+    normals_ = normals.clone();
+}
+
+const cv::Mat& Point3Cloud::getNormalsView() const{
+    return normals;
+}
     
 /*! Load/Read/Write */
-void Point3Cloud::grabFrame( cv::VideoCapture capturer, bool grabColor ){
-    capturer.grab();
+bool Point3Cloud::grabFrame( cv::VideoCapture& capturer, bool grabColor ){
+    MCV_PROFILE_SCOPE("Point3Cloud::grabFrame");
+    // The planes are retrieved into new matrices, the cloud itself is only
+    // updated once the whole frame was retrieved
+    cv::Mat frameData, frameBgr;
+    if ( !capturer.grab() || !retrieveOpenNIFrame( capturer, frameData, frameBgr, grabColor ) )
+        return false;
+    data = frameData;
     if ( grabColor )
-        capturer.retrieve( bgr, CV_CAP_OPENNI_BGR_IMAGE );
-        
-    capturer.retrieve( data, CV_CAP_OPENNI_POINT_CLOUD_MAP );
-    computeCenter();
+        bgr = frameBgr;
+    storage.release();
+    invalidateCache();
+    return true;
 }
 
-void Point3Cloud::readFrame( const std::string &name ){
-    cv::FileStorage fs( name, cv::FileStorage::READ );
-    fs["data3"]>>data;
-    fs["Cdata"]>>bgr;
+bool Point3Cloud::grabFrame( FrameSource& source, bool grabColor, double* timestamp ){
+    MCV_PROFILE_SCOPE("Point3Cloud::grabFrame(source)");
+    // The source writes into the buffers, unless they are seen elsewhere;
+    // the cloud itself is only updated once the frame was read
+    cv::Mat frameData = isShared(data) ? cv::Mat() : data;
+    cv::Mat frameBgr = isShared(bgr) ? cv::Mat() : bgr;
+    if ( !source.read( frameData, frameBgr, grabColor, timestamp ) )
+        return false;
+    data = frameData;
+    if ( grabColor )
+        bgr = frameBgr;
+    storage = source.mapping();
+    invalidateCache();
+    return true;
+}
+
+void Point3Cloud::readFrame( const std::string &name, bool verify ){
+    MCV_PROFILE_SCOPE("Point3Cloud::readFrame");
+    std::string ext = fileExtension(name);
+    if ( ext == FRAME_BINARY_EXTENSION || ext == FRAME_COMPRESSED_EXTENSION ){
+        // Raw planes stay in the mapping, no copy and no parse step
+        cv::Ptr<MappedFile> file( new MappedFile(name) );
+        decodeFrame( file->data(), file->size(), data, bgr, verify );
+        // Compressed planes are decoded into owned buffers
+        if ( pointsInto( data, *file ) || pointsInto( bgr, *file ) )
+            storage = file;
+        else
+            storage.release();
+    } else {
+        releaseShared();
+        storage.release();
+        cv::FileStorage fs( name, cv::FileStorage::READ );
+        fs["data3"]>>data;
+        fs["Cdata"]>>bgr;
+    }
+    invalidateCache();
 }
 
 void Point3Cloud::writeFrame( const std::string &name ){
-    cv::FileStorage fs( name, cv::FileStorage::WRITE );
-    fs<<"data3"<<data;
-    fs<<"Cdata"<<bgr;
+    MCV_PROFILE_SCOPE("Point3Cloud::writeFrame");
+    std::string ext = fileExtension(name);
+    if ( ext == FRAME_BINARY_EXTENSION || ext == FRAME_COMPRESSED_EXTENSION ){
+        std::vector<uchar> blob;
+        mcv::encodeFrame( data, bgr, blob, ext == FRAME_COMPRESSED_EXTENSION ?
+                                           FRAME_ENCODING_DEPTH16 : FRAME_ENCODING_RAW );
+        writeBlob( name, blob );
+    } else {
+        cv::FileStorage fs( name, cv::FileStorage::WRITE );
+        fs<<"data3"<<data;
+        fs<<"Cdata"<<bgr;
+    }
+}
+
+bool Point3Cloud::readFrame( FrameSequenceReader& sequence, double* timestamp ){
+    MCV_PROFILE_SCOPE("Point3Cloud::readFrame(sequence)");
+    if ( !sequence.read( data, bgr, timestamp ) )
+        return false;
+    storage = sequence.mapping();
+    invalidateCache();
+    return true;
+}
+
+void Point3Cloud::writeFrame( FrameSequenceWriter& sequence, double timestamp ) const{
+    MCV_PROFILE_SCOPE("Point3Cloud::writeFrame(sequence)");
+    sequence.write( data, bgr, timestamp );
+}
+
+FrameEncoding Point3Cloud::encodeFrame( std::vector<uchar>& blob, FrameEncoding encoding ) const{
+    return mcv::encodeFrame( data, bgr, blob, encoding );
 }
 
 /*! Public Methods */
 void Point3Cloud::applyTransformation( const cv::Matx33f& rotation,
                                        const cv::Vec3f translation ){
-    for( cv::MatIterator_<cv::Vec3f> it = data.begin<cv::Vec3f>(); 
-         it != data.end<cv::Vec3f>(); ++it ){
-        cv::Vec3f theV( *it );
-        cv::Point3f theP(theV[0],theV[1],theV[2]);
-        cv::Point3f newP = rotation*theP;
-        *it = cv::Vec3f(newP.x, newP.y, newP.z) + translation;
-    }
-    computeCenter();
+    MCV_PROFILE_SCOPE("Point3Cloud::applyTransformation");
+    const float m[12] = { rotation(0,0), rotation(0,1), rotation(0,2), translation[0],
+                          rotation(1,0), rotation(1,1), rotation(1,2), translation[1],
+                          rotation(2,0), rotation(2,1), rotation(2,2), translation[2] };
+    applyKernel( [&m]( float* p, size_t count ){
+        transformPoints( p, p, count, m );
+    });
+    rotateNormals( m );
+
+    // The centroid moves with the points, the axis-aligned box does not
+    if ( bounds.centerValid && bounds.count > 0 )
+        bounds.center = rotation*bounds.center + translation;
+    bounds.boxValid = false;
 }
 
 void Point3Cloud::applyRotation( const cv::Matx33f& rotX, const cv::Matx33f& rotY,
                     const cv::Matx33f& rotZ ){
+    MCV_PROFILE_SCOPE("Point3Cloud::applyRotation");
     cv::Matx33f fullR = rotX*rotY*rotZ;
-    for( cv::MatIterator_<cv::Vec3f> it = data.begin<cv::Vec3f>(); 
-         it != data.end<cv::Vec3f>(); ++it ){
-        cv::Vec3f theV( *it );
-        cv::Point3f theP(theV[0],theV[1],theV[2]);
-        cv::Point3f newP = fullR*theP;
-        *it = cv::Vec3f(newP.x, newP.y, newP.z);
-    }
-    computeCenter();
+    const float m[12] = { fullR(0,0), fullR(0,1), fullR(0,2), 0.f,
+                          fullR(1,0), fullR(1,1), fullR(1,2), 0.f,
+                          fullR(2,0), fullR(2,1), fullR(2,2), 0.f };
+    applyKernel( [&m]( float* p, size_t count ){
+        transformPoints( p, p, count, m );
+    });
+    rotateNormals( m );
+
+    if ( bounds.centerValid && bounds.count > 0 )
+        bounds.center = fullR*bounds.center;
+    bounds.boxValid = false;
 }
 
 void Point3Cloud::applyTranslation( const cv::Vec3f& translation ){
-    for( cv::MatIterator_<cv::Vec3f> it = data.begin<cv::Vec3f>(); 
-         it != data.end<cv::Vec3f>(); ++it ){
-        *it += translation;;
+    MCV_PROFILE_SCOPE("Point3Cloud::applyTranslation");
+    const float t[3] = { translation[0], translation[1], translation[2] };
+    applyKernel( [&t]( float* p, size_t count ){
+        translatePoints( p, p, count, t );
+    });
+
+    // Exact: min/max commute with adding the same offset to every point
+    if ( bounds.count > 0 ){
+        bounds.center += translation;
+        bounds.pmin += translation;
+        bounds.pmax += translation;
     }
-    computeCenter();
 }
 
 void Point3Cloud::displayColor2D( const std::string name ){
@@ -138,23 +379,244 @@ void Point3Cloud::displayColor2D( const std::string name ){
         cv::imshow( name, bgr );
 }
 
+void Point3Cloud::swap( Point3Cloud& other ){
+    std::swap( data, other.data );
+    std::swap( bgr, other.bgr );
+    std::swap( normals, other.normals );
+    std::swap( storage, other.storage );
+    std::swap( bounds, other.bounds );
+    std::swap( compact, other.compact );
+}
+
+/*! Bounds */
+const cv::Vec3f& Point3Cloud::getBBCenter() const{
+    if ( !bounds.centerValid )
+        computeBounds();
+    return bounds.center;
+}
+
+const cv::Vec3f& Point3Cloud::getBBMin() const{
+    if ( !bounds.boxValid )
+        computeBounds();
+    return bounds.pmin;
+}
+
+const cv::Vec3f& Point3Cloud::getBBMax() const{
+    if ( !bounds.boxValid )
+        computeBounds();
+    return bounds.pmax;
+}
+
+float Point3Cloud::getBBDistance() const{
+    if ( !bounds.boxValid )
+        computeBounds();
+    return bounds.distance;
+}
+
+size_t Point3Cloud::getValidCount() const{
+    if ( !bounds.centerValid )
+        computeBounds();
+    return bounds.count;
+}
+
+/*! Compact view */
+const cv::Mat& Point3Cloud::getCompactData() const{
+    if ( !compact.valid )
+        buildCompact();
+    return compact.points;
+}
+
+const cv::Mat& Point3Cloud::getCompactBgr() const{
+    if ( !compact.valid )
+        buildCompact();
+    return compact.bgr;
+}
+
+const cv::Mat& Point3Cloud::getCompactIndex() const{
+    if ( !compact.valid )
+        buildCompact();
+    return compact.index;
+}
+
+bool Point3Cloud::hasCompact() const{
+    return compact.valid;
+}
+
+void Point3Cloud::releaseCompact(){
+    compact.points.release();
+    compact.bgr.release();
+    compact.index.release();
+    compact.valid = false;
+}
+
 /*! Private Methods */
-void Point3Cloud::computeCenter(){
-    bBPmin=data.at<cv::Vec3f>(0,0);
-    bBPmax=data.at<cv::Vec3f>(0,0);
-    
-    for( cv::MatIterator_<cv::Vec3f> it = data.begin<cv::Vec3f>(); 
-         it != data.end<cv::Vec3f>(); ++it ){
-        cv::Vec3f P( *it );
-        for( int j=0; j<2; j++){
-            bBPmin[j] = std::min( bBPmin[j], P[j] );
-            bBPmax[j] = std::max( bBPmax[j], P[j] );
+void Point3Cloud::detach(){
+    if ( !data.empty() && isShared(data) )
+        data = data.clone();
+}
+
+void Point3Cloud::releaseShared(){
+    if ( isShared(data) )
+        data.release();
+    if ( isShared(bgr) )
+        bgr.release();
+}
+
+void Point3Cloud::invalidateCache(){
+    releaseCompact();
+    normals.release();
+    bounds.center = bounds.pmin = bounds.pmax = cv::Vec3f(0,0,0);
+    bounds.distance = 0;
+    bounds.count = 0;
+    bounds.centerValid = bounds.boxValid = data.empty();
+}
+
+void Point3Cloud::computeBounds() const{
+    MCV_PROFILE_SCOPE("Point3Cloud::computeBounds");
+    BoundsAccumulator total;
+    total.pmin = cv::Vec3f( FLT_MAX, FLT_MAX, FLT_MAX );
+    total.pmax = cv::Vec3f( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+    total.sum = cv::Vec3d( 0, 0, 0 );
+    total.count = 0;
+
+    // Per-band partial bounds, folded in band order (deterministic)
+    auto join = []( BoundsAccumulator& acc, const BoundsAccumulator& part ){
+        for( int k=0; k<3; k++ ){
+            acc.pmin[k] = std::min( acc.pmin[k], part.pmin[k] );
+            acc.pmax[k] = std::max( acc.pmax[k], part.pmax[k] );
+            acc.sum[k] += part.sum[k];
         }
-        bBCenter += P;
+        acc.count += part.count;
+    };
+
+    if ( compact.valid ){
+        // Only the valid points, no grid traversal
+        const cv::Vec3f* points = compact.points.ptr<cv::Vec3f>();
+        total = parallelReduceRows( compact.points.rows, total,
+            [points]( int begin, int end, BoundsAccumulator& acc ){
+                accumulateBounds( points + begin, end - begin, acc );
+            }, join, COMPACT_GRAIN );
+    } else if ( !data.empty() ){
+        CV_Assert( data.type() == CV_32FC3 );
+        total = parallelReduceRows( data.rows, total,
+            [this]( int begin, int end, BoundsAccumulator& acc ){
+                for( int i=begin; i<end; i++ )
+                    accumulateBounds( data.ptr<cv::Vec3f>(i), data.cols, acc );
+            }, join );
     }
 
-    bBCenter/=data.rows*data.cols;
-    bBDistance = norm(bBPmax-bBPmin);
+    bounds.count = static_cast<size_t>( total.count );
+    if ( bounds.count == 0 ){
+        bounds.center = bounds.pmin = bounds.pmax = cv::Vec3f(0,0,0);
+        bounds.distance = 0;
+    } else {
+        bounds.pmin = total.pmin;
+        bounds.pmax = total.pmax;
+        for( int k=0; k<3; k++ )
+            bounds.center[k] = static_cast<float>( total.sum[k] / total.count );
+        bounds.distance = static_cast<float>( norm(bounds.pmax-bounds.pmin) );
+    }
+    bounds.centerValid = bounds.boxValid = true;
+}
+
+void Point3Cloud::buildCompact() const{
+    compact.valid = true;
+    if ( data.empty() ){
+        compact.points.release();
+        compact.bgr.release();
+        compact.index.release();
+        return;
+    }
+    CV_Assert( data.type() == CV_32FC3 );
+    const bool withColor = !bgr.empty() && bgr.size() == data.size() &&
+                           bgr.type() == CV_8UC3;
+
+    // Count the valid points of each band, then let every band fill its
+    // own slice: the compact arrays keep the row-major order of the grid
+    const int bands = bandCount( data.rows );
+    std::vector<int> first( bands + 1, 0 );
+    parallelForBands( data.rows, [&]( int band, int begin, int end ){
+        int n = 0;
+        for( int i=begin; i<end; i++ ){
+            const cv::Vec3f* row = data.ptr<cv::Vec3f>(i);
+            for( int j=0; j<data.cols; j++ )
+                n += isValidPoint( row[j] );
+        }
+        first[band+1] = n;
+    });
+    for( int b=0; b<bands; b++ )
+        first[b+1] += first[b];
+
+    // Fresh buffers: the previous ones may be shared with a copy
+    const int count = first[bands];
+    compact.points = cv::Mat( count, 1, CV_32FC3 );
+    compact.index = cv::Mat( count, 1, CV_32SC1 );
+    compact.bgr = withColor ? cv::Mat( count, 1, CV_8UC3 ) : cv::Mat();
+    if ( count == 0 )
+        return;
+
+    cv::Vec3f* points = compact.points.ptr<cv::Vec3f>();
+    int* index = compact.index.ptr<int>();
+    cv::Vec3b* colors = withColor ? compact.bgr.ptr<cv::Vec3b>() : 0;
+    parallelForBands( data.rows, [&]( int band, int begin, int end ){
+        int n = first[band];
+        for( int i=begin; i<end; i++ ){
+            const cv::Vec3f* row = data.ptr<cv::Vec3f>(i);
+            const cv::Vec3b* rowColor = withColor ? bgr.ptr<cv::Vec3b>(i) : 0;
+            for( int j=0; j<data.cols; j++ ){
+                if ( !isValidPoint( row[j] ) )
+                    continue;
+                points[n] = row[j];
+                index[n] = i*data.cols + j;
+                if ( colors )
+                    colors[n] = rowColor[j];
+                n++;
+            }
+        }
+    });
+}
+
+void Point3Cloud::rotateNormals( const float m[12] ){
+    if ( normals.empty() )
+        return;
+    if ( isShared(normals) )
+        normals = normals.clone();
+    // Unknown normals are (0,0,0), which the kernel leaves untouched
+    const float r[12] = { m[0], m[1], m[2],  0.f,
+                          m[4], m[5], m[6],  0.f,
+                          m[8], m[9], m[10], 0.f };
+    forPackedRows( normals, [&r]( float* p, size_t count ){
+        transformPoints( p, p, count, r );
+    });
+}
+
+void Point3Cloud::applyKernel( const std::function<void(float*,size_t)>& kernel ){
+    detach();
+    if ( !compact.valid ){
+        forPackedRows( data, kernel );
+        return;
+    }
+
+    // Only the valid points are processed, then written back to the grid;
+    // invalid pixels are left as they are
+    if ( isShared( compact.points ) )
+        compact.points = compact.points.clone();
+    forPackedRows( compact.points, kernel, COMPACT_GRAIN );
+
+    const cv::Vec3f* points = compact.points.ptr<cv::Vec3f>();
+    const int* index = compact.index.ptr<int>();
+    const bool packed = data.isContinuous();
+    const int cols = data.cols;
+    parallelForRows( compact.points.rows, [&]( int begin, int end ){
+        if ( packed ){
+            cv::Vec3f* grid = data.ptr<cv::Vec3f>();
+            for( int n=begin; n<end; n++ )
+                grid[index[n]] = points[n];
+            return;
+        }
+        for( int n=begin; n<end; n++ )
+            data.ptr<cv::Vec3f>( index[n]/cols )[ index[n]%cols ] = points[n];
+    }, COMPACT_GRAIN );
 }
 
 } // mcv
@@ -5,8 +5,13 @@
 *****************************************************************************/
 
 #include "PointCloudViewer.hpp"
+#include "Profiler.hpp"
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <GL/glext.h>
+
+#include <utility>
 
 namespace mcv {
 void PointCloudViewerDrawCallback(void* param){
@@ -15,10 +20,20 @@ void PointCloudViewerDrawCallback(void* param){
         ctx->draw();
 }
 
-PointCloudViewer::PointCloudViewer(std::string windowName, cv::Size frameSize)
+PointCloudViewer::PointCloudViewer(OffscreenContext* offscreen, const std::string& windowName, cv::Size frameSize)
   : m_isTextureInitialized(false)
+  , m_areBuffersInitialized(false)
+  , m_isCloudUploaded(false)
+  , m_vertexCount(0)
+  , m_hasColors(false)
+  , m_hasNormals(false)
   , m_windowName(windowName)
-  , size(frameSize){
+  , size(frameSize)
+  , m_offscreen(offscreen){
+}
+
+PointCloudViewer::PointCloudViewer(std::string windowName, cv::Size frameSize)
+  : PointCloudViewer(0, windowName, frameSize){
     // Create window with OpenGL support
     cv::namedWindow(windowName, CV_WINDOW_OPENGL);
     // Resize it exactly to video size
@@ -28,19 +43,58 @@ PointCloudViewer::PointCloudViewer(std::string windowName, cv::Size frameSize)
     cv::setOpenGlDrawCallback(windowName, PointCloudViewerDrawCallback, this);
 }
 
+PointCloudViewer::PointCloudViewer(OffscreenContext& offscreen)
+  : PointCloudViewer(&offscreen, std::string(), offscreen.size()){
+}
+
 PointCloudViewer::~PointCloudViewer(){
-    cv::setOpenGlDrawCallback(m_windowName, 0, 0);
+    if (m_areBuffersInitialized){
+        makeCurrent();
+        GLuint buffers[] = { m_vertexBufferId, m_colorBufferId, m_normalBufferId };
+        glDeleteBuffers(3, buffers);
+    }
+    if (!m_offscreen)
+        cv::setOpenGlDrawCallback(m_windowName, 0, 0);
+}
+
+void PointCloudViewer::makeCurrent(){
+    if (m_offscreen)
+        m_offscreen->makeCurrent();
+    else
+        cv::setOpenGlContext(m_windowName);
 }
 
 void PointCloudViewer::updatePointCloud(const Point3Cloud &cloud){
-    m_pointCloud = Point3Cloud(cloud);
+    m_pointCloud = cloud;
+    m_isCloudUploaded = false;
+}
+
+void PointCloudViewer::updatePointCloud(Point3Cloud &&cloud){
+    m_pointCloud = std::move(cloud);
+    m_isCloudUploaded = false;
 }
 
 void PointCloudViewer::updateWindow(){
-    cv::updateWindow(m_windowName);
+    if (m_offscreen){
+        m_offscreen->makeCurrent();
+        m_offscreen->beginFrame();
+        draw();
+        m_offscreen->endFrame();
+    }else{
+        cv::updateWindow(m_windowName);
+    }
+}
+
+bool PointCloudViewer::retrieveFrame(cv::Mat& image, bool wait){
+    if (!m_offscreen)
+        return false;
+    m_offscreen->makeCurrent();
+    return m_offscreen->retrieveFrame(image, wait);
 }
 
 void PointCloudViewer::draw(){
+    MCV_PROFILE_GPU_COLLECT(this);
+    MCV_PROFILE_SCOPE("PointCloudViewer::draw");
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT); // Clear entire screen:
     drawScene(); // Draw PC
     glFlush();
@@ -70,15 +124,79 @@ void PointCloudViewer::drawScene(){
     drawPointCloud();
 }
 
+void PointCloudViewer::uploadPointCloud(){
+    MCV_PROFILE_SCOPE("PointCloudViewer::uploadPointCloud");
+    if (!m_areBuffersInitialized){
+        GLuint buffers[3];
+        glGenBuffers(3, buffers);
+        m_vertexBufferId = buffers[0];
+        m_colorBufferId  = buffers[1];
+        m_normalBufferId = buffers[2];
+        m_areBuffersInitialized = true;
+    }
+
+    // Only the valid points, the pixels without depth are not sent to GL
+    const cv::Mat& points = m_pointCloud.getCompactData();
+    const cv::Mat& bgr = m_pointCloud.getCompactBgr();
+    const cv::Mat& normals = m_pointCloud.getNormalsView();
+    const int* index = m_pointCloud.getCompactIndex().ptr<int>();
+    m_vertexCount = points.rows;
+    m_hasColors = !bgr.empty();
+    m_hasNormals = !normals.empty() && normals.isContinuous();
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferId);
+    glBufferData(GL_ARRAY_BUFFER, m_vertexCount*3*sizeof(GLfloat), points.ptr<float>(), GL_STATIC_DRAW);
+
+    // GL has no BGR colour arrays, swap the channels while filling the buffer
+    if (m_hasColors){
+        glBindBuffer(GL_ARRAY_BUFFER, m_colorBufferId);
+        glBufferData(GL_ARRAY_BUFFER, m_vertexCount*3, 0, GL_STATIC_DRAW);
+        GLubyte* rgb = static_cast<GLubyte*>(glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY));
+        if (rgb){
+            const uchar* src = bgr.ptr<uchar>();
+            for (int i=0; i<m_vertexCount; i++, rgb+=3, src+=3){
+                rgb[0] = src[2];
+                rgb[1] = src[1];
+                rgb[2] = src[0];
+            }
+            m_hasColors = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+        }else{
+            m_hasColors = false;
+        }
+    }
+
+    // Normals stay in the grid, the compact index says where
+    if (m_hasNormals){
+        glBindBuffer(GL_ARRAY_BUFFER, m_normalBufferId);
+        glBufferData(GL_ARRAY_BUFFER, m_vertexCount*3*sizeof(GLfloat), 0, GL_STATIC_DRAW);
+        Vec3f* dst = static_cast<Vec3f*>(glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY));
+        if (dst){
+            const Vec3f* gridNormals = normals.ptr<Vec3f>();
+            for (int i=0; i<m_vertexCount; i++)
+                dst[i] = gridNormals[index[i]];
+            m_hasNormals = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+        }else{
+            m_hasNormals = false;
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_isCloudUploaded = true;
+}
+
 void PointCloudViewer::drawPointCloud(){
+    MCV_PROFILE_SCOPE("PointCloudViewer::drawPointCloud");
+    MCV_PROFILE_GPU_SCOPE("PointCloudViewer::drawPointCloud", this);
     glPushMatrix();
     glViewport(0, 0, size.width, size.height);
 
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
 
-    double znear = m_pointCloud.bBDistance*0.1;
-    double zfar = m_pointCloud.bBDistance*5;
+    // Cached by the cloud, only rescanned after it changes
+    float distance = m_pointCloud.getBBDistance();
+    double znear = distance*0.1;
+    double zfar = distance*5;
 
     gluPerspective(
                     45, // 45 deg is ok
@@ -87,8 +205,8 @@ void PointCloudViewer::drawPointCloud(){
                     zfar // same
                     );
 
-    cv::Vec3f cameraTarget = m_pointCloud.bBCenter;
-    cv::Vec3f cameraPosition = cameraTarget + cv::Vec3f(m_pointCloud.bBDistance,0,m_pointCloud.bBDistance);
+    cv::Vec3f cameraTarget = m_pointCloud.getBBCenter();
+    cv::Vec3f cameraPosition = cameraTarget + cv::Vec3f(distance,0,distance);
 
     gluLookAt(
         cameraPosition[0], cameraPosition[1], cameraPosition[2],
@@ -100,25 +218,30 @@ void PointCloudViewer::drawPointCloud(){
     glEnable(GL_LIGHTING);
 
     glPointSize(1.0);
-    glBegin(GL_POINTS);
-
-    //bool color_on=false;
-    cv::Mat bgr, points;
-    m_pointCloud.getBgr(bgr);
-    m_pointCloud.getData(points);
-
-    for( int i=0 ; i<points.rows; i++ ){
-        for( int j=0 ; j<points.cols; j++ ){
-            //if(color_on){
-                cv::Vec3b bgrPixel = bgr.at<Vec3b>(i,j);
-                glColor3b(bgrPixel[2],bgrPixel[1],bgrPixel[0]);
-            //}
-            cv::Vec3f theP = points.at<Vec3f>(i,j);
-            glVertex3f(theP[0],theP[1],theP[2]);
-        }
+
+    if (!m_isCloudUploaded)
+        uploadPointCloud();
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferId);
+    glVertexPointer(3, GL_FLOAT, 0, 0);
+    if (m_hasColors){
+        glEnableClientState(GL_COLOR_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, m_colorBufferId);
+        glColorPointer(3, GL_UNSIGNED_BYTE, 0, 0);
+    }
+    if (m_hasNormals){
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glBindBuffer(GL_ARRAY_BUFFER, m_normalBufferId);
+        glNormalPointer(GL_FLOAT, 0, 0);
     }
 
-    glEnd();
+    glDrawArrays(GL_POINTS, 0, m_vertexCount);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     ///////
     glEnable(GL_COLOR_MATERIAL);
@@ -0,0 +1,528 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "PointKernels.hpp"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#include <immintrin.h>
+#define MCV_X86_SIMD 1
+#define MCV_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace mcv {
+
+/*! Scalar */
+static void transformScalar( const float* src, float* dst, size_t count, const float m[12] ){
+    for( size_t i=0; i<count; i++, src+=3, dst+=3 ){
+        float x = src[0], y = src[1], z = src[2];
+        if ( x == 0.f && y == 0.f && z == 0.f ){
+            dst[0] = dst[1] = dst[2] = 0.f;
+            continue;
+        }
+        dst[0] = m[0]*x + m[1]*y + m[2]*z + m[3];
+        dst[1] = m[4]*x + m[5]*y + m[6]*z + m[7];
+        dst[2] = m[8]*x + m[9]*y + m[10]*z + m[11];
+    }
+}
+
+static void translateScalar( const float* src, float* dst, size_t count, const float t[3] ){
+    for( size_t i=0; i<count; i++, src+=3, dst+=3 ){
+        if ( src[0] == 0.f && src[1] == 0.f && src[2] == 0.f ){
+            dst[0] = dst[1] = dst[2] = 0.f;
+            continue;
+        }
+        dst[0] = src[0] + t[0];
+        dst[1] = src[1] + t[1];
+        dst[2] = src[2] + t[2];
+    }
+}
+
+template<typename T>
+static void backprojectScalar( const T* depth, const float* rays, float* dst,
+                               size_t count, float scale ){
+    for( size_t i=0; i<count; i++, rays+=3, dst+=3 ){
+        float z = depth[i]*scale;
+        dst[0] = rays[0]*z;
+        dst[1] = rays[1]*z;
+        dst[2] = rays[2]*z;
+    }
+}
+
+template<bool Distorted>
+static void projectScalar( const float* src, float* dst, size_t count,
+                           const float m[12], const float c[9] ){
+    for( size_t i=0; i<count; i++, src+=3, dst+=2 ){
+        float x = src[0], y = src[1], z = src[2];
+        float X = m[0]*x + m[1]*y + m[2]*z + m[3];
+        float Y = m[4]*x + m[5]*y + m[6]*z + m[7];
+        float Z = m[8]*x + m[9]*y + m[10]*z + m[11];
+        float iz = Z != 0.f ? 1.f/Z : 1.f;
+        float a = X*iz, b = Y*iz;
+        if ( Distorted ){
+            float aa = a*a, bb = b*b, ab = a*b;
+            float r2 = aa + bb;
+            float radial = ( ( c[8]*r2 + c[5] )*r2 + c[4] )*r2 + 1.f;
+            float two = 2.f;
+            float da = a*radial + ( c[6]*two*ab + c[7]*( r2 + two*aa ) );
+            float db = b*radial + ( c[6]*( r2 + two*bb ) + c[7]*two*ab );
+            a = da;
+            b = db;
+        }
+        dst[0] = c[0]*a + c[2];
+        dst[1] = c[1]*b + c[3];
+    }
+}
+
+#ifdef MCV_X86_SIMD
+/*  Four packed points fill three registers
+ *      a = x0 y0 z0 x1   b = y1 z1 x2 y2   c = z2 x3 y3 z3
+ *  and are transposed to x = x0..x3, y = y0..y3, z = z0..z3 and back. The
+ *  same shuffles work per 128 bit lane in AVX, each lane holding its own
+ *  block of four points. */
+#define MCV_DEINTERLEAVE(SHUF, a, b, c, x, y, z )                                \
+    {                                                                            \
+        x = SHUF( a, SHUF( b, c, _MM_SHUFFLE(1,0,3,2) ), _MM_SHUFFLE(3,0,3,0) ); \
+        y = SHUF( SHUF( a, b, _MM_SHUFFLE(0,0,1,1) ),                            \
+                  SHUF( b, c, _MM_SHUFFLE(2,2,3,3) ), _MM_SHUFFLE(2,0,2,0) );    \
+        z = SHUF( SHUF( a, b, _MM_SHUFFLE(1,1,2,2) ), c, _MM_SHUFFLE(3,0,2,0) ); \
+    }
+
+#define MCV_INTERLEAVE(SHUF, x, y, z, a, b, c )                                  \
+    {                                                                            \
+        a = SHUF( SHUF( x, y, _MM_SHUFFLE(0,0,0,0) ),                            \
+                  SHUF( z, x, _MM_SHUFFLE(1,1,0,0) ), _MM_SHUFFLE(2,0,2,0) );    \
+        b = SHUF( SHUF( y, z, _MM_SHUFFLE(1,1,1,1) ),                            \
+                  SHUF( x, y, _MM_SHUFFLE(2,2,2,2) ), _MM_SHUFFLE(2,0,2,0) );    \
+        c = SHUF( SHUF( z, x, _MM_SHUFFLE(3,3,2,2) ),                            \
+                  SHUF( y, z, _MM_SHUFFLE(3,3,3,3) ), _MM_SHUFFLE(2,0,2,0) );    \
+    }
+
+/*! SSE2 */
+/*! All-ones lanes for the points not at the origin (NaN counts as valid) */
+MCV_TARGET("sse2")
+static inline __m128 validSSE2( __m128 x, __m128 y, __m128 z ){
+    __m128 zero = _mm_setzero_ps();
+    return _mm_or_ps( _mm_or_ps( _mm_cmpneq_ps( x, zero ), _mm_cmpneq_ps( y, zero ) ),
+                      _mm_cmpneq_ps( z, zero ) );
+}
+
+MCV_TARGET("sse2")
+static void transformSSE2( const float* src, float* dst, size_t count, const float m[12] ){
+    __m128 m00 = _mm_set1_ps(m[0]), m01 = _mm_set1_ps(m[1]), m02 = _mm_set1_ps(m[2]),  m03 = _mm_set1_ps(m[3]);
+    __m128 m10 = _mm_set1_ps(m[4]), m11 = _mm_set1_ps(m[5]), m12 = _mm_set1_ps(m[6]),  m13 = _mm_set1_ps(m[7]);
+    __m128 m20 = _mm_set1_ps(m[8]), m21 = _mm_set1_ps(m[9]), m22 = _mm_set1_ps(m[10]), m23 = _mm_set1_ps(m[11]);
+
+    size_t i = 0;
+    for( ; i+4<=count; i+=4, src+=12, dst+=12 ){
+        __m128 a = _mm_loadu_ps(src), b = _mm_loadu_ps(src+4), c = _mm_loadu_ps(src+8);
+        __m128 x, y, z;
+        MCV_DEINTERLEAVE( _mm_shuffle_ps, a, b, c, x, y, z );
+
+        __m128 ox = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(m00,x), _mm_mul_ps(m01,y) ), _mm_mul_ps(m02,z) ), m03 );
+        __m128 oy = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(m10,x), _mm_mul_ps(m11,y) ), _mm_mul_ps(m12,z) ), m13 );
+        __m128 oz = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(m20,x), _mm_mul_ps(m21,y) ), _mm_mul_ps(m22,z) ), m23 );
+        __m128 valid = validSSE2( x, y, z );
+        ox = _mm_and_ps( ox, valid );
+        oy = _mm_and_ps( oy, valid );
+        oz = _mm_and_ps( oz, valid );
+
+        MCV_INTERLEAVE( _mm_shuffle_ps, ox, oy, oz, a, b, c );
+        _mm_storeu_ps( dst, a );
+        _mm_storeu_ps( dst+4, b );
+        _mm_storeu_ps( dst+8, c );
+    }
+    transformScalar( src, dst, count - i, m );
+}
+
+MCV_TARGET("sse2")
+static void translateSSE2( const float* src, float* dst, size_t count, const float t[3] ){
+    __m128 tx = _mm_set1_ps(t[0]), ty = _mm_set1_ps(t[1]), tz = _mm_set1_ps(t[2]);
+
+    size_t i = 0;
+    for( ; i+4<=count; i+=4, src+=12, dst+=12 ){
+        __m128 a = _mm_loadu_ps(src), b = _mm_loadu_ps(src+4), c = _mm_loadu_ps(src+8);
+        __m128 x, y, z;
+        MCV_DEINTERLEAVE( _mm_shuffle_ps, a, b, c, x, y, z );
+
+        __m128 valid = validSSE2( x, y, z );
+        __m128 ox = _mm_and_ps( _mm_add_ps( x, tx ), valid );
+        __m128 oy = _mm_and_ps( _mm_add_ps( y, ty ), valid );
+        __m128 oz = _mm_and_ps( _mm_add_ps( z, tz ), valid );
+
+        MCV_INTERLEAVE( _mm_shuffle_ps, ox, oy, oz, a, b, c );
+        _mm_storeu_ps( dst, a );
+        _mm_storeu_ps( dst+4, b );
+        _mm_storeu_ps( dst+8, c );
+    }
+    translateScalar( src, dst, count - i, t );
+}
+
+/*! Four depths as floats */
+MCV_TARGET("sse2")
+static inline __m128 loadDepthSSE2( const uint16_t* depth ){
+    __m128i d = _mm_loadl_epi64( reinterpret_cast<const __m128i*>(depth) );
+    return _mm_cvtepi32_ps( _mm_unpacklo_epi16( d, _mm_setzero_si128() ) );
+}
+
+MCV_TARGET("sse2")
+static inline __m128 loadDepthSSE2( const float* depth ){
+    return _mm_loadu_ps( depth );
+}
+
+template<typename T>
+MCV_TARGET("sse2")
+static void backprojectSSE2( const T* depth, const float* rays, float* dst,
+                             size_t count, float scale ){
+    __m128 s = _mm_set1_ps(scale);
+
+    size_t i = 0;
+    for( ; i+4<=count; i+=4, rays+=12, dst+=12 ){
+        __m128 a = _mm_loadu_ps(rays), b = _mm_loadu_ps(rays+4), c = _mm_loadu_ps(rays+8);
+        __m128 x, y, z;
+        MCV_DEINTERLEAVE( _mm_shuffle_ps, a, b, c, x, y, z );
+
+        __m128 d = _mm_mul_ps( loadDepthSSE2( depth+i ), s );
+        x = _mm_mul_ps( x, d );
+        y = _mm_mul_ps( y, d );
+        z = _mm_mul_ps( z, d );
+
+        MCV_INTERLEAVE( _mm_shuffle_ps, x, y, z, a, b, c );
+        _mm_storeu_ps( dst, a );
+        _mm_storeu_ps( dst+4, b );
+        _mm_storeu_ps( dst+8, c );
+    }
+    backprojectScalar( depth+i, rays, dst, count - i, scale );
+}
+
+template<bool Distorted>
+MCV_TARGET("sse2")
+static void projectSSE2( const float* src, float* dst, size_t count,
+                         const float m[12], const float c[9] ){
+    __m128 m00 = _mm_set1_ps(m[0]), m01 = _mm_set1_ps(m[1]), m02 = _mm_set1_ps(m[2]),  m03 = _mm_set1_ps(m[3]);
+    __m128 m10 = _mm_set1_ps(m[4]), m11 = _mm_set1_ps(m[5]), m12 = _mm_set1_ps(m[6]),  m13 = _mm_set1_ps(m[7]);
+    __m128 m20 = _mm_set1_ps(m[8]), m21 = _mm_set1_ps(m[9]), m22 = _mm_set1_ps(m[10]), m23 = _mm_set1_ps(m[11]);
+    __m128 fx = _mm_set1_ps(c[0]), fy = _mm_set1_ps(c[1]), cx = _mm_set1_ps(c[2]), cy = _mm_set1_ps(c[3]);
+    __m128 k1 = _mm_set1_ps(c[4]), k2 = _mm_set1_ps(c[5]), p1 = _mm_set1_ps(c[6]), p2 = _mm_set1_ps(c[7]);
+    __m128 k3 = _mm_set1_ps(c[8]);
+    __m128 one = _mm_set1_ps(1.f), two = _mm_set1_ps(2.f), zero = _mm_setzero_ps();
+
+    size_t i = 0;
+    for( ; i+4<=count; i+=4, src+=12, dst+=8 ){
+        __m128 a = _mm_loadu_ps(src), b = _mm_loadu_ps(src+4), c = _mm_loadu_ps(src+8);
+        __m128 x, y, z;
+        MCV_DEINTERLEAVE( _mm_shuffle_ps, a, b, c, x, y, z );
+
+        __m128 X = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(m00,x), _mm_mul_ps(m01,y) ), _mm_mul_ps(m02,z) ), m03 );
+        __m128 Y = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(m10,x), _mm_mul_ps(m11,y) ), _mm_mul_ps(m12,z) ), m13 );
+        __m128 Z = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(m20,x), _mm_mul_ps(m21,y) ), _mm_mul_ps(m22,z) ), m23 );
+        __m128 zeroZ = _mm_cmpeq_ps( Z, zero );
+        __m128 iz = _mm_or_ps( _mm_andnot_ps( zeroZ, _mm_div_ps( one, Z ) ), _mm_and_ps( zeroZ, one ) );
+        __m128 u = _mm_mul_ps( X, iz ), v = _mm_mul_ps( Y, iz );
+        if ( Distorted ){
+            __m128 uu = _mm_mul_ps(u,u), vv = _mm_mul_ps(v,v), uv = _mm_mul_ps(u,v);
+            __m128 r2 = _mm_add_ps( uu, vv );
+            __m128 radial = _mm_add_ps( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( k3, r2 ), k2 ), r2 ), k1 ), r2 ), one );
+            __m128 du = _mm_add_ps( _mm_mul_ps( u, radial ),
+                                    _mm_add_ps( _mm_mul_ps( _mm_mul_ps( p1, two ), uv ),
+                                                _mm_mul_ps( p2, _mm_add_ps( r2, _mm_mul_ps( two, uu ) ) ) ) );
+            __m128 dv = _mm_add_ps( _mm_mul_ps( v, radial ),
+                                    _mm_add_ps( _mm_mul_ps( p1, _mm_add_ps( r2, _mm_mul_ps( two, vv ) ) ),
+                                                _mm_mul_ps( _mm_mul_ps( p2, two ), uv ) ) );
+            u = du;
+            v = dv;
+        }
+        u = _mm_add_ps( _mm_mul_ps( fx, u ), cx );
+        v = _mm_add_ps( _mm_mul_ps( fy, v ), cy );
+
+        _mm_storeu_ps( dst,   _mm_unpacklo_ps( u, v ) );
+        _mm_storeu_ps( dst+4, _mm_unpackhi_ps( u, v ) );
+    }
+    projectScalar<Distorted>( src, dst, count - i, m, c );
+}
+
+/*! AVX2 */
+MCV_TARGET("avx2")
+static inline __m256 loadBlocks( const float* lo, const float* hi ){
+    return _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps(lo) ), _mm_loadu_ps(hi), 1 );
+}
+
+MCV_TARGET("avx2")
+static inline void storeBlocks( float* lo, float* hi, __m256 v ){
+    _mm_storeu_ps( lo, _mm256_castps256_ps128(v) );
+    _mm_storeu_ps( hi, _mm256_extractf128_ps( v, 1 ) );
+}
+
+MCV_TARGET("avx2")
+static inline __m256 validAVX2( __m256 x, __m256 y, __m256 z ){
+    __m256 zero = _mm256_setzero_ps();
+    return _mm256_or_ps( _mm256_or_ps( _mm256_cmp_ps( x, zero, _CMP_NEQ_UQ ),
+                                       _mm256_cmp_ps( y, zero, _CMP_NEQ_UQ ) ),
+                         _mm256_cmp_ps( z, zero, _CMP_NEQ_UQ ) );
+}
+
+MCV_TARGET("avx2")
+static void transformAVX2( const float* src, float* dst, size_t count, const float m[12] ){
+    __m256 m00 = _mm256_set1_ps(m[0]), m01 = _mm256_set1_ps(m[1]), m02 = _mm256_set1_ps(m[2]),  m03 = _mm256_set1_ps(m[3]);
+    __m256 m10 = _mm256_set1_ps(m[4]), m11 = _mm256_set1_ps(m[5]), m12 = _mm256_set1_ps(m[6]),  m13 = _mm256_set1_ps(m[7]);
+    __m256 m20 = _mm256_set1_ps(m[8]), m21 = _mm256_set1_ps(m[9]), m22 = _mm256_set1_ps(m[10]), m23 = _mm256_set1_ps(m[11]);
+
+    size_t i = 0;
+    for( ; i+8<=count; i+=8, src+=24, dst+=24 ){
+        // Low lane: points 0-3, high lane: points 4-7
+        __m256 a = loadBlocks( src,   src+12 );
+        __m256 b = loadBlocks( src+4, src+16 );
+        __m256 c = loadBlocks( src+8, src+20 );
+        __m256 x, y, z;
+        MCV_DEINTERLEAVE( _mm256_shuffle_ps, a, b, c, x, y, z );
+
+        __m256 ox = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps(m00,x), _mm256_mul_ps(m01,y) ), _mm256_mul_ps(m02,z) ), m03 );
+        __m256 oy = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps(m10,x), _mm256_mul_ps(m11,y) ), _mm256_mul_ps(m12,z) ), m13 );
+        __m256 oz = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps(m20,x), _mm256_mul_ps(m21,y) ), _mm256_mul_ps(m22,z) ), m23 );
+        __m256 valid = validAVX2( x, y, z );
+        ox = _mm256_and_ps( ox, valid );
+        oy = _mm256_and_ps( oy, valid );
+        oz = _mm256_and_ps( oz, valid );
+
+        MCV_INTERLEAVE( _mm256_shuffle_ps, ox, oy, oz, a, b, c );
+        storeBlocks( dst,   dst+12, a );
+        storeBlocks( dst+4, dst+16, b );
+        storeBlocks( dst+8, dst+20, c );
+    }
+    transformSSE2( src, dst, count - i, m );
+}
+
+MCV_TARGET("avx2")
+static void translateAVX2( const float* src, float* dst, size_t count, const float t[3] ){
+    __m256 tx = _mm256_set1_ps(t[0]), ty = _mm256_set1_ps(t[1]), tz = _mm256_set1_ps(t[2]);
+
+    size_t i = 0;
+    for( ; i+8<=count; i+=8, src+=24, dst+=24 ){
+        __m256 a = loadBlocks( src,   src+12 );
+        __m256 b = loadBlocks( src+4, src+16 );
+        __m256 c = loadBlocks( src+8, src+20 );
+        __m256 x, y, z;
+        MCV_DEINTERLEAVE( _mm256_shuffle_ps, a, b, c, x, y, z );
+
+        __m256 valid = validAVX2( x, y, z );
+        __m256 ox = _mm256_and_ps( _mm256_add_ps( x, tx ), valid );
+        __m256 oy = _mm256_and_ps( _mm256_add_ps( y, ty ), valid );
+        __m256 oz = _mm256_and_ps( _mm256_add_ps( z, tz ), valid );
+
+        MCV_INTERLEAVE( _mm256_shuffle_ps, ox, oy, oz, a, b, c );
+        storeBlocks( dst,   dst+12, a );
+        storeBlocks( dst+4, dst+16, b );
+        storeBlocks( dst+8, dst+20, c );
+    }
+    translateSSE2( src, dst, count - i, t );
+}
+
+template<bool Distorted>
+MCV_TARGET("avx2")
+static void projectAVX2( const float* src, float* dst, size_t count,
+                         const float m[12], const float c[9] ){
+    __m256 m00 = _mm256_set1_ps(m[0]), m01 = _mm256_set1_ps(m[1]), m02 = _mm256_set1_ps(m[2]),  m03 = _mm256_set1_ps(m[3]);
+    __m256 m10 = _mm256_set1_ps(m[4]), m11 = _mm256_set1_ps(m[5]), m12 = _mm256_set1_ps(m[6]),  m13 = _mm256_set1_ps(m[7]);
+    __m256 m20 = _mm256_set1_ps(m[8]), m21 = _mm256_set1_ps(m[9]), m22 = _mm256_set1_ps(m[10]), m23 = _mm256_set1_ps(m[11]);
+    __m256 fx = _mm256_set1_ps(c[0]), fy = _mm256_set1_ps(c[1]), cx = _mm256_set1_ps(c[2]), cy = _mm256_set1_ps(c[3]);
+    __m256 k1 = _mm256_set1_ps(c[4]), k2 = _mm256_set1_ps(c[5]), p1 = _mm256_set1_ps(c[6]), p2 = _mm256_set1_ps(c[7]);
+    __m256 k3 = _mm256_set1_ps(c[8]);
+    __m256 one = _mm256_set1_ps(1.f), two = _mm256_set1_ps(2.f), zero = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for( ; i+8<=count; i+=8, src+=24, dst+=16 ){
+        __m256 a = loadBlocks( src,   src+12 );
+        __m256 b = loadBlocks( src+4, src+16 );
+        __m256 c = loadBlocks( src+8, src+20 );
+        __m256 x, y, z;
+        MCV_DEINTERLEAVE( _mm256_shuffle_ps, a, b, c, x, y, z );
+
+        __m256 X = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps(m00,x), _mm256_mul_ps(m01,y) ), _mm256_mul_ps(m02,z) ), m03 );
+        __m256 Y = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps(m10,x), _mm256_mul_ps(m11,y) ), _mm256_mul_ps(m12,z) ), m13 );
+        __m256 Z = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps(m20,x), _mm256_mul_ps(m21,y) ), _mm256_mul_ps(m22,z) ), m23 );
+        __m256 iz = _mm256_blendv_ps( _mm256_div_ps( one, Z ), one, _mm256_cmp_ps( Z, zero, _CMP_EQ_OQ ) );
+        __m256 u = _mm256_mul_ps( X, iz ), v = _mm256_mul_ps( Y, iz );
+        if ( Distorted ){
+            __m256 uu = _mm256_mul_ps(u,u), vv = _mm256_mul_ps(v,v), uv = _mm256_mul_ps(u,v);
+            __m256 r2 = _mm256_add_ps( uu, vv );
+            __m256 radial = _mm256_add_ps( _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( k3, r2 ), k2 ), r2 ), k1 ), r2 ), one );
+            __m256 du = _mm256_add_ps( _mm256_mul_ps( u, radial ),
+                                       _mm256_add_ps( _mm256_mul_ps( _mm256_mul_ps( p1, two ), uv ),
+                                                      _mm256_mul_ps( p2, _mm256_add_ps( r2, _mm256_mul_ps( two, uu ) ) ) ) );
+            __m256 dv = _mm256_add_ps( _mm256_mul_ps( v, radial ),
+                                       _mm256_add_ps( _mm256_mul_ps( p1, _mm256_add_ps( r2, _mm256_mul_ps( two, vv ) ) ),
+                                                      _mm256_mul_ps( _mm256_mul_ps( p2, two ), uv ) ) );
+            u = du;
+            v = dv;
+        }
+        u = _mm256_add_ps( _mm256_mul_ps( fx, u ), cx );
+        v = _mm256_add_ps( _mm256_mul_ps( fy, v ), cy );
+
+        // Per lane: lo = p0 p1 (p4 p5), hi = p2 p3 (p6 p7)
+        __m256 lo = _mm256_unpacklo_ps( u, v ), hi = _mm256_unpackhi_ps( u, v );
+        storeBlocks( dst,   dst+8,  lo );
+        storeBlocks( dst+4, dst+12, hi );
+    }
+    projectSSE2<Distorted>( src, dst, count - i, m, c );
+}
+
+/*! Eight depths as floats, depths 0-3 in the low lane */
+MCV_TARGET("avx2")
+static inline __m256 loadDepthAVX2( const uint16_t* depth ){
+    __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i*>(depth) );
+    return _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( d ) );
+}
+
+MCV_TARGET("avx2")
+static inline __m256 loadDepthAVX2( const float* depth ){
+    return _mm256_loadu_ps( depth );
+}
+
+template<typename T>
+MCV_TARGET("avx2")
+static void backprojectAVX2( const T* depth, const float* rays, float* dst,
+                             size_t count, float scale ){
+    __m256 s = _mm256_set1_ps(scale);
+
+    size_t i = 0;
+    for( ; i+8<=count; i+=8, rays+=24, dst+=24 ){
+        __m256 a = loadBlocks( rays,   rays+12 );
+        __m256 b = loadBlocks( rays+4, rays+16 );
+        __m256 c = loadBlocks( rays+8, rays+20 );
+        __m256 x, y, z;
+        MCV_DEINTERLEAVE( _mm256_shuffle_ps, a, b, c, x, y, z );
+
+        __m256 d = _mm256_mul_ps( loadDepthAVX2( depth+i ), s );
+        x = _mm256_mul_ps( x, d );
+        y = _mm256_mul_ps( y, d );
+        z = _mm256_mul_ps( z, d );
+
+        MCV_INTERLEAVE( _mm256_shuffle_ps, x, y, z, a, b, c );
+        storeBlocks( dst,   dst+12, a );
+        storeBlocks( dst+4, dst+16, b );
+        storeBlocks( dst+8, dst+20, c );
+    }
+    backprojectSSE2( depth+i, rays, dst, count - i, scale );
+}
+#endif
+
+/*! Dispatch */
+static KernelIsa& currentIsa(){
+    static KernelIsa isa = detectKernelIsa();
+    return isa;
+}
+
+KernelIsa detectKernelIsa(){
+#ifdef MCV_X86_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") )
+        return KERNEL_AVX2;
+    if ( __builtin_cpu_supports("sse2") )
+        return KERNEL_SSE2;
+#endif
+    return KERNEL_SCALAR;
+}
+
+KernelIsa kernelIsa(){
+    return currentIsa();
+}
+
+void setKernelIsa( KernelIsa isa ){
+    currentIsa() = std::min( isa, detectKernelIsa() );
+}
+
+void transformPoints( const float* src, float* dst, size_t count, const float m[12] ){
+    switch( currentIsa() ){
+#ifdef MCV_X86_SIMD
+    case KERNEL_AVX2: transformAVX2( src, dst, count, m ); break;
+    case KERNEL_SSE2: transformSSE2( src, dst, count, m ); break;
+#endif
+    default:          transformScalar( src, dst, count, m ); break;
+    }
+}
+
+void translatePoints( const float* src, float* dst, size_t count, const float t[3] ){
+    switch( currentIsa() ){
+#ifdef MCV_X86_SIMD
+    case KERNEL_AVX2: translateAVX2( src, dst, count, t ); break;
+    case KERNEL_SSE2: translateSSE2( src, dst, count, t ); break;
+#endif
+    default:          translateScalar( src, dst, count, t ); break;
+    }
+}
+
+void projectPoints( const float* src, float* dst, size_t count,
+                    const float m[12], const float camera[9] ){
+    bool distorted = false;
+    for( int k=4; k<9; k++ )
+        distorted = distorted || camera[k] != 0.f;
+
+    switch( currentIsa() ){
+#ifdef MCV_X86_SIMD
+    case KERNEL_AVX2:
+        if ( distorted ) projectAVX2<true>( src, dst, count, m, camera );
+        else             projectAVX2<false>( src, dst, count, m, camera );
+        break;
+    case KERNEL_SSE2:
+        if ( distorted ) projectSSE2<true>( src, dst, count, m, camera );
+        else             projectSSE2<false>( src, dst, count, m, camera );
+        break;
+#endif
+    default:
+        if ( distorted ) projectScalar<true>( src, dst, count, m, camera );
+        else             projectScalar<false>( src, dst, count, m, camera );
+        break;
+    }
+}
+
+template<typename T>
+static void backprojectDispatch( const T* depth, const float* rays, float* dst,
+                                 size_t count, float scale ){
+    switch( currentIsa() ){
+#ifdef MCV_X86_SIMD
+    case KERNEL_AVX2: backprojectAVX2( depth, rays, dst, count, scale ); break;
+    case KERNEL_SSE2: backprojectSSE2( depth, rays, dst, count, scale ); break;
+#endif
+    default:          backprojectScalar( depth, rays, dst, count, scale ); break;
+    }
+}
+
+void backprojectDepth( const uint16_t* depth, const float* rays, float* dst,
+                       size_t count, float scale ){
+    backprojectDispatch( depth, rays, dst, count, scale );
+}
+
+void backprojectDepth( const float* depth, const float* rays, float* dst,
+                       size_t count, float scale ){
+    backprojectDispatch( depth, rays, dst, count, scale );
+}
+
+} // mcv
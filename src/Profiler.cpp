@@ -0,0 +1,298 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "Profiler.hpp"
+
+#include <opencv2/opencv.hpp>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
+/*! Profiler */
+namespace mcv {
+
+/*! Histogram buckets: exact below 8 ns, then 8 per power of two */
+static int bucketOf( uint64_t ns ){
+    if ( ns < 8 )
+        return int(ns);
+    int msb = 63 - __builtin_clzll( ns );
+    return ( msb - 2 )*8 + int( ( ns >> ( msb - 3 ) ) & 7 );
+}
+
+static double bucketMiddle( int b ){
+    if ( b < 8 )
+        return b;
+    double width = double( uint64_t(1) << ( b/8 - 1 ) );
+    return ( 8 + b%8 )*width + 0.5*width;
+}
+
+/*! Small per-thread numbers for the trace, 0 is the GPU track */
+static int threadIndex(){
+    static std::atomic<int> next(1);
+    thread_local int index = next++;
+    return index;
+}
+
+static std::string escapeJson( const std::string& text ){
+    std::string escaped;
+    for( size_t i=0; i<text.size(); i++ ){
+        if ( text[i] == '"' || text[i] == '\\' )
+            escaped += '\\';
+        escaped += text[i];
+    }
+    return escaped;
+}
+
+/*! Quoted CSV field content: quotes are doubled */
+static std::string escapeCsv( const std::string& text ){
+    std::string escaped;
+    for( size_t i=0; i<text.size(); i++ ){
+        if ( text[i] == '"' )
+            escaped += '"';
+        escaped += text[i];
+    }
+    return escaped;
+}
+
+Profiler& Profiler::instance(){
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler()
+  : m_stageCount(0)
+  , m_tracing(false)
+  , m_origin(now()){
+    for( int i=0; i<PROFILE_MAX_STAGES; i++ )
+        m_stages[i] = 0;
+}
+
+Profiler::~Profiler(){
+    for( int i=0; i<PROFILE_MAX_STAGES; i++ )
+        delete m_stages[i];
+}
+
+int64_t Profiler::now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+int Profiler::stage( const std::string& name ){
+    std::lock_guard<std::mutex> lock( m_stageMutex );
+    int count = m_stageCount.load( std::memory_order_relaxed );
+    for( int i=0; i<count; i++ )
+        if ( m_stages[i]->name == name )
+            return i;
+    if ( count == PROFILE_MAX_STAGES )
+        CV_Error( CV_StsOutOfRange, "Too many profiler stages" );
+
+    Stage* s = new Stage;
+    s->name = name;
+    s->count = 0;
+    s->totalNs = 0;
+    s->maxNs = 0;
+    for( int b=0; b<PROFILE_BUCKETS; b++ )
+        s->buckets[b] = 0;
+    m_stages[count] = s;
+    m_stageCount.store( count + 1, std::memory_order_release );
+    return count;
+}
+
+void Profiler::record( int stage, int64_t startNs, int64_t durationNs, bool gpu ){
+    if ( stage < 0 || stage >= m_stageCount.load( std::memory_order_acquire ) )
+        return;
+    Stage& s = *m_stages[stage];
+    uint64_t d = durationNs > 0 ? uint64_t(durationNs) : 0;
+    s.count.fetch_add( 1, std::memory_order_relaxed );
+    s.totalNs.fetch_add( d, std::memory_order_relaxed );
+    s.buckets[ bucketOf(d) ].fetch_add( 1, std::memory_order_relaxed );
+    uint64_t previous = s.maxNs.load( std::memory_order_relaxed );
+    while( d > previous && !s.maxNs.compare_exchange_weak( previous, d, std::memory_order_relaxed ) ){
+    }
+
+    if ( m_tracing.load( std::memory_order_relaxed ) ){
+        TraceEvent event = { stage, gpu ? 0 : threadIndex(), startNs, int64_t(d) };
+        std::lock_guard<std::mutex> lock( m_traceMutex );
+        if ( m_trace.size() < PROFILE_MAX_TRACE )
+            m_trace.push_back( event );
+    }
+}
+
+void Profiler::setTracing( bool enabled ){
+    m_tracing.store( enabled );
+}
+
+bool Profiler::isTracing() const{
+    return m_tracing.load();
+}
+
+void Profiler::reset(){
+    int count = m_stageCount.load( std::memory_order_acquire );
+    for( int i=0; i<count; i++ ){
+        Stage& s = *m_stages[i];
+        s.count = 0;
+        s.totalNs = 0;
+        s.maxNs = 0;
+        for( int b=0; b<PROFILE_BUCKETS; b++ )
+            s.buckets[b] = 0;
+    }
+    std::lock_guard<std::mutex> lock( m_traceMutex );
+    m_trace.clear();
+    m_origin = now();
+}
+
+std::vector<ProfileStats> Profiler::snapshot() const{
+    std::vector<ProfileStats> stats;
+    int count = m_stageCount.load( std::memory_order_acquire );
+    for( int i=0; i<count; i++ ){
+        const Stage& s = *m_stages[i];
+        uint64_t buckets[PROFILE_BUCKETS], total = 0;
+        for( int b=0; b<PROFILE_BUCKETS; b++ ){
+            buckets[b] = s.buckets[b].load( std::memory_order_relaxed );
+            total += buckets[b];
+        }
+
+        ProfileStats stage;
+        stage.name  = s.name;
+        stage.count = total;
+        stage.mean  = total ? s.totalNs.load()*1e-6/total : 0;
+        stage.max   = s.maxNs.load()*1e-6;
+        const double quantiles[3] = { 0.50, 0.95, 0.99 };
+        double* values[3] = { &stage.p50, &stage.p95, &stage.p99 };
+        for( int q=0; q<3; q++ ){
+            *values[q] = 0;
+            if ( !total )
+                continue;
+            uint64_t rank = uint64_t( std::ceil( quantiles[q]*total ) ), seen = 0;
+            for( int b=0; b<PROFILE_BUCKETS; b++ ){
+                seen += buckets[b];
+                if ( seen >= rank ){
+                    *values[q] = std::min( bucketMiddle(b)*1e-6, stage.max );
+                    break;
+                }
+            }
+        }
+        stats.push_back( stage );
+    }
+    return stats;
+}
+
+void Profiler::writeCsv( const std::string& name ) const{
+    std::ofstream file( name.c_str() );
+    if ( !file )
+        CV_Error( CV_StsError, "Cannot open " + name );
+    std::vector<ProfileStats> stats = snapshot();
+    file << "stage,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+    for( size_t i=0; i<stats.size(); i++ )
+        file << '"' << escapeCsv( stats[i].name ) << "\"," << stats[i].count << ',' << stats[i].mean << ','
+             << stats[i].p50 << ',' << stats[i].p95 << ',' << stats[i].p99 << ','
+             << stats[i].max << '\n';
+}
+
+void Profiler::writeJson( const std::string& name ) const{
+    std::ofstream file( name.c_str() );
+    if ( !file )
+        CV_Error( CV_StsError, "Cannot open " + name );
+    std::vector<ProfileStats> stats = snapshot();
+    file << "{\"stages\":[";
+    for( size_t i=0; i<stats.size(); i++ )
+        file << ( i ? "," : "" ) << "\n{\"name\":\"" << escapeJson( stats[i].name )
+             << "\",\"count\":" << stats[i].count << ",\"mean_ms\":" << stats[i].mean
+             << ",\"p50_ms\":" << stats[i].p50 << ",\"p95_ms\":" << stats[i].p95
+             << ",\"p99_ms\":" << stats[i].p99 << ",\"max_ms\":" << stats[i].max << "}";
+    file << "\n]}\n";
+}
+
+void Profiler::writeChromeTrace( const std::string& name ) const{
+    std::ofstream file( name.c_str() );
+    if ( !file )
+        CV_Error( CV_StsError, "Cannot open " + name );
+
+    // Events are recorded after their stage is registered: with the trace
+    // locked first, every stage they refer to is in the count
+    std::lock_guard<std::mutex> lock( m_traceMutex );
+    std::vector<std::string> names;
+    int count = m_stageCount.load( std::memory_order_acquire );
+    for( int i=0; i<count; i++ )
+        names.push_back( escapeJson( m_stages[i]->name ) );
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+         << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+    for( size_t i=0; i<m_trace.size(); i++ ){
+        const TraceEvent& e = m_trace[i];
+        file << ",\n{\"name\":\"" << names[e.stage] << "\",\"cat\":\""
+             << ( e.thread ? "cpu" : "gpu" ) << "\",\"ph\":\"X\",\"ts\":"
+             << ( e.startNs - m_origin )*1e-3 << ",\"dur\":" << e.durationNs*1e-3
+             << ",\"pid\":1,\"tid\":" << e.thread << "}";
+    }
+    file << "\n]}\n";
+}
+
+void Profiler::beginGpu( int, const void*, unsigned int queries[2], int64_t& cpuStart ){
+    glGenQueries( 2, queries );
+    glQueryCounter( queries[0], GL_TIMESTAMP );
+    cpuStart = now();
+}
+
+void Profiler::endGpu( int stage, const void* owner, const unsigned int queries[2], int64_t cpuStart ){
+    glQueryCounter( queries[1], GL_TIMESTAMP );
+    GpuScope scope = { stage, owner, { queries[0], queries[1] }, cpuStart };
+    std::lock_guard<std::mutex> lock( m_gpuMutex );
+    m_gpuPending.push_back( scope );
+}
+
+void Profiler::collectGpu( const void* owner ){
+    std::lock_guard<std::mutex> lock( m_gpuMutex );
+    size_t kept = 0;
+    for( size_t i=0; i<m_gpuPending.size(); i++ ){
+        GpuScope& scope = m_gpuPending[i];
+        GLint available = 0;
+        if ( scope.owner == owner )
+            glGetQueryObjectiv( scope.queries[1], GL_QUERY_RESULT_AVAILABLE, &available );
+        if ( !available ){
+            m_gpuPending[kept++] = scope;
+            continue;
+        }
+        // The queries complete in order, the first one is ready as well
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v( scope.queries[0], GL_QUERY_RESULT, &begin );
+        glGetQueryObjectui64v( scope.queries[1], GL_QUERY_RESULT, &end );
+        glDeleteQueries( 2, scope.queries );
+        record( scope.stage, scope.cpuStart, int64_t( end - begin ), true );
+    }
+    m_gpuPending.resize( kept );
+}
+
+} // mcv
@@ -0,0 +1,281 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "Registration.hpp"
+#include "Parallel.hpp"
+
+#include <cmath>
+
+/*! Registration */
+namespace mcv {
+
+/*! Upper triangle of J'J, J'r and the squared residuals of a band */
+struct NormalEquations
+{
+    double ATA[21];
+    double ATb[6];
+    double residual2;
+    int    count;
+};
+
+static void clearEquations( NormalEquations& eq ){
+    for( int k=0; k<21; k++ )
+        eq.ATA[k] = 0;
+    for( int k=0; k<6; k++ )
+        eq.ATb[k] = 0;
+    eq.residual2 = 0;
+    eq.count = 0;
+}
+
+/*! Rotation of angle |w| around w (Rodrigues) */
+static cv::Matx33d rotationFromVector( const cv::Vec3d& w ){
+    double angle = std::sqrt( w.dot(w) );
+    if ( angle < 1e-12 )
+        return cv::Matx33d::eye();
+    cv::Vec3d k = w*(1.0/angle);
+    cv::Matx33d K( 0, -k[2], k[1],
+                   k[2], 0, -k[0],
+                   -k[1], k[0], 0 );
+    return cv::Matx33d::eye() + K*std::sin(angle) + K*K*(1 - std::cos(angle));
+}
+
+IcpRegistration::IcpRegistration()
+  : m_hasCalibration(false)
+  , m_maxDistance(0.1f)
+  , m_minRotation(1e-4f)
+  , m_minTranslation(1e-4f){
+    const int iterations[] = { 4, 5, 10 };
+    m_iterations.assign( iterations, iterations + 3 );
+}
+
+void IcpRegistration::setCalibration( const CameraCalibration& calibration ){
+    m_calibration = calibration;
+    m_hasCalibration = true;
+}
+
+bool IcpRegistration::hasCalibration() const{
+    return m_hasCalibration;
+}
+
+const CameraCalibration& IcpRegistration::getCalibration() const{
+    return m_calibration;
+}
+
+NormalEstimator& IcpRegistration::normalEstimator(){
+    return m_normalEstimator;
+}
+
+void IcpRegistration::setIterations( const std::vector<int>& iterationsPerLevel ){
+    CV_Assert( !iterationsPerLevel.empty() );
+    m_iterations = iterationsPerLevel;
+}
+
+const std::vector<int>& IcpRegistration::getIterations() const{
+    return m_iterations;
+}
+
+void IcpRegistration::setMaxCorrespondenceDistance( float distance ){
+    CV_Assert( distance > 0 );
+    m_maxDistance = distance;
+}
+
+float IcpRegistration::getMaxCorrespondenceDistance() const{
+    return m_maxDistance;
+}
+
+void IcpRegistration::setConvergence( float rotation, float translation ){
+    m_minRotation = rotation;
+    m_minTranslation = translation;
+}
+
+IcpResult IcpRegistration::align( const Point3Cloud& source, const Point3Cloud& target,
+                                  const Transformation& guess ){
+    const cv::Mat& src = source.getDataView();
+    const cv::Mat& dst = target.getDataView();
+    CV_Assert( src.type() == CV_32FC3 && dst.type() == CV_32FC3 );
+
+    if ( !m_hasCalibration ){
+        if ( !estimateCalibration( dst, m_calibration ) )
+            CV_Error( CV_StsBadArg, "Cannot estimate the intrinsics of the target cloud" );
+        m_hasCalibration = true;
+    }
+    if ( !target.hasNormals() )
+        m_normalEstimator.compute( dst, m_normals );
+    const cv::Mat& normals = target.hasNormals() ? target.getNormalsView() : m_normals;
+    CV_Assert( normals.size() == dst.size() );
+
+    const float fx = m_calibration.fx(), fy = m_calibration.fy();
+    const float cx = m_calibration.cx(), cy = m_calibration.cy();
+    const float maxDistance2 = m_maxDistance*m_maxDistance;
+
+    // Current estimate, composed in double precision
+    cv::Matx33d R;
+    cv::Vec3d t;
+    for( int a=0; a<3; a++ ){
+        for( int b=0; b<3; b++ )
+            R(a,b) = guess.r()(a,b);
+        t[a] = guess.t()[a];
+    }
+
+    IcpResult result;
+    result.converged = false;
+    result.correspondences = 0;
+    result.rmse = 0;
+
+    NormalEquations init;
+    clearEquations( init );
+
+    bool degenerate = false;
+    for( int level=int(m_iterations.size())-1; level>=0 && !degenerate; level-- ){
+        const int step = 1 << level;
+        const int rows = ( src.rows + step - 1 )/step;
+
+        for( int iteration=0; iteration<m_iterations[level]; iteration++ ){
+            int64 start = cv::getTickCount();
+            cv::Matx33f Rf;
+            cv::Vec3f tf;
+            for( int a=0; a<3; a++ ){
+                for( int c=0; c<3; c++ )
+                    Rf(a,c) = static_cast<float>( R(a,c) );
+                tf[a] = static_cast<float>( t[a] );
+            }
+
+            NormalEquations eq = parallelReduceRows( rows, init,
+                [&]( int begin, int end, NormalEquations& acc ){
+                    for( int r=begin; r<end; r++ ){
+                        // Single precision within a row, double across rows
+                        float A[21] = { 0 }, b[6] = { 0 }, e2 = 0;
+                        int n = 0;
+                        const cv::Vec3f* S = src.ptr<cv::Vec3f>( r*step );
+                        for( int j=0; j<src.cols; j+=step ){
+                            const cv::Vec3f& p = S[j];
+                            if ( !isValidPoint(p) )
+                                continue;
+                            cv::Vec3f q = Rf*p + tf;
+                            if ( !( q[2] > 0 ) )
+                                continue;
+                            int u = cvRound( fx*q[0]/q[2] + cx );
+                            int v = cvRound( fy*q[1]/q[2] + cy );
+                            if ( u < 0 || v < 0 || u >= dst.cols || v >= dst.rows )
+                                continue;
+                            const cv::Vec3f& d = dst.at<cv::Vec3f>(v, u);
+                            const cv::Vec3f& nrm = normals.at<cv::Vec3f>(v, u);
+                            if ( !isValidPoint(nrm) )
+                                continue;
+                            cv::Vec3f diff = q - d;
+                            if ( diff.dot(diff) > maxDistance2 )
+                                continue;
+
+                            // r + J.[w t], J = [q x n, n]
+                            float res = nrm.dot(diff);
+                            cv::Vec3f qn = q.cross(nrm);
+                            float J[6] = { qn[0], qn[1], qn[2], nrm[0], nrm[1], nrm[2] };
+                            for( int a=0, k=0; a<6; a++ ){
+                                for( int c=a; c<6; c++ )
+                                    A[k++] += J[a]*J[c];
+                                b[a] -= J[a]*res;
+                            }
+                            e2 += res*res;
+                            n++;
+                        }
+                        for( int k=0; k<21; k++ )
+                            acc.ATA[k] += A[k];
+                        for( int k=0; k<6; k++ )
+                            acc.ATb[k] += b[k];
+                        acc.residual2 += e2;
+                        acc.count += n;
+                    }
+                },
+                []( NormalEquations& acc, const NormalEquations& part ){
+                    for( int k=0; k<21; k++ )
+                        acc.ATA[k] += part.ATA[k];
+                    for( int k=0; k<6; k++ )
+                        acc.ATb[k] += part.ATb[k];
+                    acc.residual2 += part.residual2;
+                    acc.count += part.count;
+                } );
+
+            IcpIteration report;
+            report.level = level;
+            report.iteration = iteration;
+            report.correspondences = eq.count;
+            report.rmse = eq.count ? std::sqrt( eq.residual2/eq.count ) : 0;
+            result.correspondences = eq.count;
+            result.rmse = report.rmse;
+
+            // Too few pairs to constrain the six unknowns
+            if ( eq.count < 6 ){
+                report.timeMs = ( cv::getTickCount() - start )*1000./cv::getTickFrequency();
+                result.iterations.push_back( report );
+                degenerate = true;
+                break;
+            }
+
+            cv::Matx66d A;
+            cv::Vec6d b;
+            for( int a=0, k=0; a<6; a++ ){
+                for( int c=a; c<6; c++, k++ )
+                    A(a,c) = A(c,a) = eq.ATA[k];
+                b[a] = eq.ATb[a];
+            }
+            cv::Mat x;
+            bool solved = cv::solve( cv::Mat(A), cv::Mat(b), x, cv::DECOMP_CHOLESKY );
+            report.timeMs = ( cv::getTickCount() - start )*1000./cv::getTickFrequency();
+            result.iterations.push_back( report );
+            if ( !solved ){
+                degenerate = true;
+                break;
+            }
+
+            cv::Vec3d w( x.at<double>(0), x.at<double>(1), x.at<double>(2) );
+            cv::Vec3d dt( x.at<double>(3), x.at<double>(4), x.at<double>(5) );
+            cv::Matx33d dR = rotationFromVector( w );
+            R = dR*R;
+            t = dR*t + dt;
+
+            if ( std::sqrt( w.dot(w) ) < m_minRotation && std::sqrt( dt.dot(dt) ) < m_minTranslation ){
+                result.converged = level == 0;
+                break;
+            }
+        }
+    }
+
+    cv::Matx33f Rout;
+    cv::Vec3f tout;
+    for( int a=0; a<3; a++ ){
+        for( int b=0; b<3; b++ )
+            Rout(a,b) = static_cast<float>( R(a,b) );
+        tout[a] = static_cast<float>( t[a] );
+    }
+    result.transformation = Transformation( Rout, tout );
+    return result;
+}
+
+} // mcv
@@ -0,0 +1,210 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+#include "VoxelGrid.hpp"
+#include "Parallel.hpp"
+
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*! VoxelGrid */
+namespace mcv {
+
+enum { VOXEL_KEY_BITS   = 21,       // per axis, three axes in a 64 bit key
+       VOXEL_PARTITIONS = 16,       // independent hash tables
+       VOXEL_GRAIN      = 8192 };   // points per band of the key pass
+
+/*! Spreads neighbouring keys over the buckets and the partitions */
+struct VoxelKeyHash
+{
+    size_t operator()( uint64_t key ) const{
+        return static_cast<size_t>( ( key * 0x9E3779B97F4A7C15ull ) >> 16 );
+    }
+};
+
+static int partitionOf( uint64_t key ){
+    // Top four bits of the mixed key, VOXEL_PARTITIONS == 16
+    return static_cast<int>( ( key * 0x9E3779B97F4A7C15ull ) >> 60 );
+}
+
+struct VoxelAccumulator
+{
+    cv::Vec3d sum;
+    cv::Vec3i color;
+    int       count;
+};
+
+VoxelGridFilter::VoxelGridFilter( float leafSize )
+  : m_minPoints(1){
+    setLeafSize( leafSize );
+}
+
+VoxelGridFilter::VoxelGridFilter( const cv::Vec3f& leafSize )
+  : m_minPoints(1){
+    setLeafSize( leafSize );
+}
+
+void VoxelGridFilter::setLeafSize( float leafSize ){
+    setLeafSize( cv::Vec3f( leafSize, leafSize, leafSize ) );
+}
+
+void VoxelGridFilter::setLeafSize( const cv::Vec3f& leafSize ){
+    CV_Assert( leafSize[0] > 0 && leafSize[1] > 0 && leafSize[2] > 0 );
+    m_leafSize = leafSize;
+}
+
+const cv::Vec3f& VoxelGridFilter::getLeafSize() const{
+    return m_leafSize;
+}
+
+void VoxelGridFilter::setMinPointsPerVoxel( int minPoints ){
+    m_minPoints = std::max( minPoints, 1 );
+}
+
+int VoxelGridFilter::getMinPointsPerVoxel() const{
+    return m_minPoints;
+}
+
+void VoxelGridFilter::filter( const Point3Cloud& input, Point3Cloud& output ) const{
+    const cv::Mat& points = input.getCompactData();
+    const cv::Mat& colors = input.getCompactBgr();
+    const int count = points.rows;
+    if ( count == 0 ){
+        output = Point3Cloud();
+        return;
+    }
+
+    const cv::Vec3f origin = input.getBBMin();
+    const cv::Vec3f extent = input.getBBMax() - origin;
+    const cv::Vec3f inverse( 1.f/m_leafSize[0], 1.f/m_leafSize[1], 1.f/m_leafSize[2] );
+    for( int k=0; k<3; k++ )
+        if ( double(extent[k])*inverse[k] >= double(1 << VOXEL_KEY_BITS) - 1 )
+            CV_Error( CV_StsOutOfRange, "Leaf size too small for the extent of the cloud" );
+
+    // Voxel key of every point, counted per partition and band
+    const cv::Vec3f* P = points.ptr<cv::Vec3f>();
+    const int bands = bandCount( count, VOXEL_GRAIN );
+    std::vector<uint64_t> keys( count );
+    std::vector<uchar> partition( count );
+    std::vector<int> offsets( bands*VOXEL_PARTITIONS, 0 );
+    parallelForBands( count, [&]( int band, int begin, int end ){
+        int* histogram = &offsets[band*VOXEL_PARTITIONS];
+        for( int n=begin; n<end; n++ ){
+            uint64_t ix = static_cast<uint64_t>( cvFloor( (P[n][0] - origin[0])*inverse[0] ) );
+            uint64_t iy = static_cast<uint64_t>( cvFloor( (P[n][1] - origin[1])*inverse[1] ) );
+            uint64_t iz = static_cast<uint64_t>( cvFloor( (P[n][2] - origin[2])*inverse[2] ) );
+            keys[n] = ix | ( iy << VOXEL_KEY_BITS ) | ( iz << 2*VOXEL_KEY_BITS );
+            partition[n] = static_cast<uchar>( partitionOf( keys[n] ) );
+            histogram[ partition[n] ]++;
+        }
+    }, VOXEL_GRAIN );
+
+    // Counting sort of the point indices by partition, keeping the point
+    // order within a partition: partition-major, then band order
+    std::vector<int> first( VOXEL_PARTITIONS + 1 );
+    int offset = 0;
+    for( int part=0; part<VOXEL_PARTITIONS; part++ ){
+        first[part] = offset;
+        for( int band=0; band<bands; band++ ){
+            int bucket = offsets[band*VOXEL_PARTITIONS + part];
+            offsets[band*VOXEL_PARTITIONS + part] = offset;
+            offset += bucket;
+        }
+    }
+    first[VOXEL_PARTITIONS] = offset;
+
+    std::vector<int> order( count );
+    parallelForBands( count, [&]( int band, int begin, int end ){
+        int* next = &offsets[band*VOXEL_PARTITIONS];
+        for( int n=begin; n<end; n++ )
+            order[ next[ partition[n] ]++ ] = n;
+    }, VOXEL_GRAIN );
+
+    // Each partition owns its voxels: no locking and no merge step
+    const cv::Vec3b* C = colors.empty() ? 0 : colors.ptr<cv::Vec3b>();
+    std::vector< std::vector<VoxelAccumulator> > voxels( VOXEL_PARTITIONS );
+    parallelForBands( VOXEL_PARTITIONS, [&]( int part, int, int ){
+        std::vector<VoxelAccumulator>& acc = voxels[part];
+        std::unordered_map<uint64_t, int, VoxelKeyHash> slots;
+        slots.reserve( first[part+1] - first[part] );
+        for( int i=first[part]; i<first[part+1]; i++ ){
+            const int n = order[i];
+            std::pair<std::unordered_map<uint64_t, int, VoxelKeyHash>::iterator, bool> slot =
+                slots.insert( std::make_pair( keys[n], int(acc.size()) ) );
+            if ( slot.second ){
+                VoxelAccumulator empty;
+                empty.sum = cv::Vec3d( 0, 0, 0 );
+                empty.color = cv::Vec3i( 0, 0, 0 );
+                empty.count = 0;
+                acc.push_back( empty );
+            }
+            VoxelAccumulator& voxel = acc[slot.first->second];
+            for( int k=0; k<3; k++ ){
+                voxel.sum[k] += P[n][k];
+                if ( C )
+                    voxel.color[k] += C[n][k];
+            }
+            voxel.count++;
+        }
+    }, 1 );
+
+    // Centroids, partition after partition
+    int kept = 0;
+    for( int part=0; part<VOXEL_PARTITIONS; part++ )
+        for( size_t v=0; v<voxels[part].size(); v++ )
+            kept += voxels[part][v].count >= m_minPoints;
+
+    cv::Mat data( kept, 1, CV_32FC3 );
+    cv::Mat bgr = C ? cv::Mat( kept, 1, CV_8UC3 ) : cv::Mat();
+    int n = 0;
+    for( int part=0; part<VOXEL_PARTITIONS; part++ ){
+        for( size_t v=0; v<voxels[part].size(); v++ ){
+            const VoxelAccumulator& voxel = voxels[part][v];
+            if ( voxel.count < m_minPoints )
+                continue;
+            cv::Vec3f& centroid = data.at<cv::Vec3f>(n);
+            for( int k=0; k<3; k++ )
+                centroid[k] = static_cast<float>( voxel.sum[k] / voxel.count );
+            if ( C ){
+                cv::Vec3b& color = bgr.at<cv::Vec3b>(n);
+                for( int k=0; k<3; k++ )
+                    color[k] = static_cast<uchar>( ( voxel.color[k] + voxel.count/2 ) / voxel.count );
+            }
+            n++;
+        }
+    }
+
+    output = Point3Cloud( std::move(data), std::move(bgr) );
+}
+
+} // mcv
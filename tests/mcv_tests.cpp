@@ -0,0 +1,283 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+Copyright (c) 2013, Master in Computer Vision Project, France
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+  Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+  Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+  Neither the name of the {organization} nor the names of its
+  contributors may be used to endorse or promote products derived from
+  this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//M*/
+
+/*! mcv_tests: regression checks on the default synthetic scene
+ *
+ *  - Octree k-NN, radius and box queries against brute force
+ *  - every kernel ISA the CPU supports against the scalar kernels, which
+ *    must give bit-identical results
+ *  - CameraCalibration::project against cv::projectPoints in double, to
+ *    within float rounding (2e-4 px)
+ *
+ *  Prints every failed check and exits with the number of failures, so
+ *  it can run under CTest.
+ */
+
+// MCV
+#include "PointCloud.hpp"
+#include "FrameSource.hpp"
+#include "Octree.hpp"
+#include "PointKernels.hpp"
+#include "CameraCalibration.hpp"
+#include "GeometryTypes.hpp"
+
+// OpenCV
+#include <opencv2/opencv.hpp>
+
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK( condition, what )                                              \
+    do {                                                                      \
+        if ( !( condition ) ){                                                \
+            cout << __FILE__ << ":" << __LINE__ << ": " << what << endl;      \
+            failures++;                                                       \
+        }                                                                     \
+    } while( 0 )
+
+static float sqrDistance( const cv::Vec3f& a, const cv::Vec3f& b ){
+    cv::Vec3f d = a - b;
+    return d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+}
+
+/*! Query positions: indexed points, and points off the cloud */
+static vector<cv::Vec3f> makeQueries( const cv::Mat& points, cv::RNG& rng ){
+    vector<cv::Vec3f> queries;
+    for( int i=0; i<48; i++ )
+        queries.push_back( points.at<cv::Vec3f>( rng.uniform( 0, points.rows ) ) );
+    for( int i=0; i<16; i++ )
+        queries.push_back( cv::Vec3f( rng.uniform( -1.5f, 1.5f ), rng.uniform( -1.f, 1.f ),
+                                      rng.uniform( 0.5f, 3.5f ) ) );
+    return queries;
+}
+
+static void testOctree( const mcv::Point3Cloud& cloud ){
+    mcv::Octree octree;
+    octree.build( cloud );
+    const cv::Mat& points = octree.getPoints();
+    const int count = points.rows;
+    CHECK( size_t(count) == cloud.getValidCount(), "octree does not index every valid point" );
+
+    cv::RNG rng( 7 );
+    vector<cv::Vec3f> queries = makeQueries( points, rng );
+    const int k = 8;
+    const float radius = 0.05f;
+    vector<float> all( count );
+    vector<int> indices;
+    vector<float> distances;
+
+    for( size_t q=0; q<queries.size(); q++ ){
+        for( int i=0; i<count; i++ )
+            all[i] = sqrDistance( points.at<cv::Vec3f>(i), queries[q] );
+
+        // k-NN: the same distances as the k smallest, closest first
+        vector<float> sorted( all );
+        std::partial_sort( sorted.begin(), sorted.begin() + k, sorted.end() );
+        int found = octree.nearestKSearch( queries[q], k, indices, distances );
+        CHECK( found == k, "nearestKSearch found " << found << " points" );
+        for( int i=0; i<std::min( found, k ); i++ ){
+            CHECK( std::fabs( distances[i] - sorted[i] ) <= 1e-6f*std::max( 1.f, sorted[i] ),
+                   "nearestKSearch distance " << i << " of query " << q );
+            CHECK( std::fabs( all[ indices[i] ] - distances[i] ) <= 1e-6f*std::max( 1.f, distances[i] ),
+                   "nearestKSearch index " << i << " of query " << q );
+        }
+
+        // Radius: the same set, up to rounding right on the boundary
+        const float r2 = radius*radius;
+        octree.radiusSearch( queries[q], radius, indices, distances );
+        vector<int> expected;
+        for( int i=0; i<count; i++ )
+            if ( all[i] <= r2 )
+                expected.push_back( i );
+        std::sort( indices.begin(), indices.end() );
+        vector<int> difference;
+        std::set_symmetric_difference( indices.begin(), indices.end(), expected.begin(),
+                                       expected.end(), std::back_inserter( difference ) );
+        for( size_t i=0; i<difference.size(); i++ )
+            CHECK( std::fabs( all[ difference[i] ] - r2 ) <= 1e-6f,
+                   "radiusSearch point " << difference[i] << " of query " << q );
+
+        // Box: exact, no arithmetic involved
+        const cv::Vec3f half( 0.1f, 0.05f, 0.2f );
+        octree.boxSearch( queries[q] - half, queries[q] + half, indices );
+        expected.clear();
+        for( int i=0; i<count; i++ ){
+            const cv::Vec3f& p = points.at<cv::Vec3f>(i);
+            bool inside = true;
+            for( int c=0; c<3; c++ )
+                inside = inside && p[c] >= queries[q][c] - half[c] && p[c] <= queries[q][c] + half[c];
+            if ( inside )
+                expected.push_back( i );
+        }
+        std::sort( indices.begin(), indices.end() );
+        CHECK( indices == expected, "boxSearch of query " << q );
+    }
+
+    // Batched k-NN, whose search radius is seeded by the previous query
+    cv::Mat batch( int( queries.size() ), 1, CV_32FC3, &queries[0] ), batchIndices, batchDistances;
+    octree.nearestKSearch( batch, k, batchIndices, batchDistances );
+    for( size_t q=0; q<queries.size(); q++ ){
+        octree.nearestKSearch( queries[q], k, indices, distances );
+        for( int i=0; i<k; i++ )
+            CHECK( batchDistances.at<float>( int(q), i ) == distances[i],
+                   "batched nearestKSearch distance " << i << " of query " << q );
+    }
+}
+
+static const char* isaName( mcv::KernelIsa isa ){
+    return isa == mcv::KERNEL_AVX2 ? "avx2" : isa == mcv::KERNEL_SSE2 ? "sse2" : "scalar";
+}
+
+/*! Output of every kernel at the current ISA, concatenated */
+static vector<float> runKernels( const mcv::Point3Cloud& cloud, const mcv::CameraCalibration& calibration ){
+    const cv::Mat& data = cloud.getDataView();
+    // Not a multiple of the vector width, so that the tails run too
+    const size_t count = data.total() - 3;
+    const float* src = data.ptr<float>();
+    const float m[12] = { 0.99f, -0.14f, 0.02f, 0.1f,
+                          0.14f, 0.98f, -0.11f, -0.2f,
+                          0.01f, 0.11f, 0.99f, 0.3f };
+    const float t[3] = { 0.1f, -0.2f, 0.3f };
+    const float pinhole[9] = { 525.f, 525.f, 319.5f, 239.5f, 0, 0, 0, 0, 0 };
+    const float distorted[9] = { 525.f, 525.f, 319.5f, 239.5f, 0.1f, -0.2f, 0.001f, -0.001f, 0.05f };
+
+    vector<uint16_t> depth16( count );
+    vector<float> depth( count );
+    for( size_t i=0; i<count; i++ ){
+        depth[i] = src[3*i + 2];
+        depth16[i] = cv::saturate_cast<uint16_t>( depth[i]*1000.f );
+    }
+    const cv::Mat& rays = calibration.getRays( data.size() );
+
+    vector<float> out( 3*count*4 + 2*count*2 );
+    float* dst = &out[0];
+    mcv::transformPoints( src, dst, count, m );                               dst += 3*count;
+    mcv::translatePoints( src, dst, count, t );                               dst += 3*count;
+    mcv::backprojectDepth( &depth16[0], rays.ptr<float>(), dst, count, 1e-3f ); dst += 3*count;
+    mcv::backprojectDepth( &depth[0], rays.ptr<float>(), dst, count, 1.f );     dst += 3*count;
+    mcv::projectPoints( src, dst, count, m, pinhole );                        dst += 2*count;
+    mcv::projectPoints( src, dst, count, m, distorted );
+    return out;
+}
+
+static void testKernelIsa( const mcv::Point3Cloud& cloud, const mcv::CameraCalibration& calibration ){
+    const mcv::KernelIsa current = mcv::kernelIsa(), best = mcv::detectKernelIsa();
+    mcv::setKernelIsa( mcv::KERNEL_SCALAR );
+    const vector<float> reference = runKernels( cloud, calibration );
+
+    for( int isa=mcv::KERNEL_SSE2; isa<=best; isa++ ){
+        mcv::setKernelIsa( mcv::KernelIsa(isa) );
+        vector<float> result = runKernels( cloud, calibration );
+        CHECK( std::memcmp( &result[0], &reference[0], result.size()*sizeof(float) ) == 0,
+               isaName( mcv::KernelIsa(isa) ) << " kernels differ from the scalar ones" );
+    }
+    mcv::setKernelIsa( current );
+    cout << "kernels checked up to " << isaName( best ) << endl;
+}
+
+static void testProjection( const mcv::Point3Cloud& cloud ){
+    float coefficients[5] = { 0.1f, -0.2f, 0.001f, -0.001f, 0.05f };
+    mcv::CameraCalibration calibration( 525.f, 525.f, 319.5f, 239.5f, coefficients );
+    cv::Mat rotation;
+    cv::Rodrigues( cv::Mat( cv::Vec3d( 0.05, -0.1, 0.02 ) ), rotation );
+    cv::Matx33f R;
+    for( int r=0; r<3; r++ )
+        for( int c=0; c<3; c++ )
+            R(r,c) = float( rotation.at<double>(r,c) );
+    mcv::Transformation pose( R, cv::Vec3f( 0.05f, -0.02f, 0.1f ) );
+
+    // Valid points well in front of the camera, where the model is sane
+    vector<cv::Vec3f> points;
+    const cv::Mat& data = cloud.getDataView();
+    for( int i=0; i<data.rows; i+=2 )
+        for( int j=0; j<data.cols; j+=2 ){
+            const cv::Vec3f& p = data.at<cv::Vec3f>( i, j );
+            if ( mcv::isValidPoint(p) && ( pose.r()*p + pose.t() )[2] > 0.3f )
+                points.push_back( p );
+        }
+
+    cv::Mat pixels;
+    calibration.project( cv::Mat( points ), pose, pixels );
+
+    // Reference in double, from the very same float pose and points
+    cv::Mat reference, rvec, expected;
+    cv::Mat( points ).convertTo( reference, CV_64F );
+    cv::Mat Rd( 3, 3, CV_64F ), tvec( 3, 1, CV_64F ), K( 3, 3, CV_64F, 0.0 ), dist( 1, 5, CV_64F );
+    for( int r=0; r<3; r++ ){
+        for( int c=0; c<3; c++ )
+            Rd.at<double>(r,c) = R(r,c);
+        tvec.at<double>(r) = pose.t()[r];
+    }
+    cv::Rodrigues( Rd, rvec );
+    K.at<double>(0,0) = 525;   K.at<double>(0,2) = 319.5;
+    K.at<double>(1,1) = 525;   K.at<double>(1,2) = 239.5;
+    K.at<double>(2,2) = 1;
+    for( int k=0; k<5; k++ )
+        dist.at<double>(k) = coefficients[k];
+    cv::projectPoints( reference, rvec, tvec, K, dist, expected );
+
+    double worst = 0;
+    for( size_t i=0; i<points.size(); i++ ){
+        const cv::Vec2f& uv = pixels.at<cv::Vec2f>( int(i) );
+        const cv::Vec2d& ref = expected.at<cv::Vec2d>( int(i) );
+        worst = std::max( worst, std::max( std::fabs( uv[0] - ref[0] ),
+                                           std::fabs( uv[1] - ref[1] ) ) );
+    }
+    // Float rounding alone: one ulp of a coordinate near 640 px is 6e-5 px
+    CHECK( worst <= 2e-4, "project is " << worst << " px away from cv::projectPoints" );
+    cout << points.size() << " points projected, largest error " << worst << " px" << endl;
+}
+
+int main()
+{
+    mcv::SyntheticScene scene;
+    scene.frameRate = 0;
+    mcv::SyntheticFrameSource source( scene );
+    source.open();
+    mcv::Point3Cloud cloud;
+    CHECK( cloud.grabFrame( source ), "synthetic source gave no frame" );
+    mcv::CameraCalibration calibration( scene.fx, scene.fy, scene.cx, scene.cy );
+
+    testOctree( cloud );
+    testKernelIsa( cloud, calibration );
+    testProjection( cloud );
+
+    cout << ( failures ? "FAILED: " : "passed, " ) << failures << " failures" << endl;
+    return failures;
+}